@@ -7,6 +7,7 @@ import os
 import sys
 import subprocess
 import argparse
+import shlex
 from pathlib import Path
 import json
 import time
@@ -56,6 +57,9 @@ class Builder:
         self.DEMO_ISO_DIR = Path("demo_iso")
         self.DEMO_ISO_DIR.mkdir(exist_ok=True)
 
+        # Дополнительные -D флаги (например, -DHEAP_TRACE)
+        self.DEFINES = []
+
     def clean(self):
         """Очистить временные файлы сборки и ISO."""
         cleaned = []
@@ -65,6 +69,10 @@ class Builder:
         if self.OBJ_DIR.exists():
             run(["rm", "-rf", str(self.OBJ_DIR)])
             cleaned.append(str(self.OBJ_DIR))
+        hosted_dir = self.KERNEL_DIR / "bin-hosted"
+        if hosted_dir.exists():
+            run(["rm", "-rf", str(hosted_dir)])
+            cleaned.append(str(hosted_dir))
         # НЕ очищаем ISO_DIR - оставляем для пользовательских файлов
         if self.ISO_FILE.exists():
             self.ISO_FILE.unlink()
@@ -293,7 +301,7 @@ SECTIONS
             "-nostdinc",
             "-DLIMINE_API_REVISION=3",
             "-MMD", "-MP"
-        ]
+        ] + self.DEFINES
 
         LDFLAGS = [
             "-nostdlib", "-static",
@@ -371,6 +379,39 @@ SECTIONS
         run(link_cmd)
         print(f"[OK] Ядро собрано: {kernel_out}")
 
+    # Аллокаторы, которые собираются в хостовый бенчмарк (kernel/hosted)
+    HOSTED_SOURCES = [
+        "memory/pmm.c", "memory/paging.c", "memory/heap.c", "memory/slab.c",
+        "memory/vmm.c", "memory/vma.c", "memory/vmalloc.c", "memory/alloc_trace.c", "memory/tlb.c",
+        "libc/string/itoa.c",
+    ]
+
+    def build_hosted_bench(self):
+        """Собрать PMM, paging, кучу и VMM как обычную Linux-программу с бенчмарком."""
+        out_dir = self.KERNEL_DIR / "bin-hosted"
+        os.makedirs(out_dir, exist_ok=True)
+        output = out_dir / "deer-bench"
+
+        sources = [str(self.KERNEL_DIR / "src" / src) for src in self.HOSTED_SOURCES]
+        sources += [str(p) for p in sorted((self.KERNEL_DIR / "hosted").glob("*.c"))]
+
+        HOST_CC = os.getenv("HOST_CC", "gcc")
+        HOSTED_CFLAGS = [
+            "-g", "-O2", "-pipe", "-Wall", "-Wextra", "-std=gnu11",
+            # printf ядра понимает %x для 64-битных значений, glibc об этом предупреждает
+            "-pthread", "-DDEER_HOSTED", "-DLIMINE_API_REVISION=3", "-Wno-format",
+            f"-I{self.KERNEL_DIR}/src",
+            f"-I{self.KERNEL_DIR}/../limine-tools/limine-protocol/include",
+        ] + self.DEFINES
+
+        run([HOST_CC] + HOSTED_CFLAGS + sources + ["-o", str(output)])
+        print(f"[OK] Хостовый бенчмарк: {output}")
+        return output
+
+    def run_hosted_bench(self, bench_args=""):
+        output = self.build_hosted_bench()
+        run([str(output)] + shlex.split(bench_args))
+
     def clone_limine(self):
         if not self.LIMINE_DIR.parent.exists():
             self.LIMINE_DIR.parent.mkdir(parents=True, exist_ok=True)
@@ -606,9 +647,17 @@ def main():
                         help="Очистка проекта перед коммитом")
     parser.add_argument("--version", type=str,
                         help="Версия ОС (например, v0.1-alpha)")
+    parser.add_argument("--hosted-bench", action="store_true",
+                        help="Собрать аллокаторы ядра как Linux-программу и запустить бенчмарк")
+    parser.add_argument("--bench-args", type=str, default="",
+                        help="Аргументы для --hosted-bench (например, \"--mem 2T --threads 4\")")
+    parser.add_argument("--heap-trace", action="store_true",
+                        help="Собрать ядро с трассировкой kmalloc/kfree в кольцевой буфер (-DHEAP_TRACE)")
 
     args = parser.parse_args()
     builder = Builder(name=args.name, version=args.version)
+    if args.heap_trace:
+        builder.DEFINES.append("-DHEAP_TRACE")
 
     if args.clean:
         builder.clean()
@@ -623,6 +672,9 @@ def main():
             specific_files=specific_files, 
             structure_only=args.structure_only
         )
+    elif args.hosted_bench:
+        builder.ensure_deps()
+        builder.run_hosted_bench(args.bench_args)
     elif args.run:
         builder.ensure_deps()
         builder.build_kernel()
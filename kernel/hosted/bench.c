@@ -0,0 +1,544 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "machine.h"
+#include "include/sys/hosted.h"
+#include "include/memory/pmm.h"
+#include "include/memory/heap.h"
+#include "include/memory/vmm.h"
+
+// Бенчмарк аллокаторов DEER в обычном процессе:
+//   python3 build.py --hosted-bench --bench-args "--mem 64G --ops 2000000"
+
+#define BENCH_MAX_THREADS   HEAP_MAX_ARENAS
+#define BENCH_SAMPLE_EVERY  256
+#define BENCH_USER_BASE     0x0000100000000000ULL
+
+struct bench_options {
+    uint64_t mem;
+    uint64_t ops;
+    uint32_t live;
+    uint32_t threads;
+    uint64_t seed;
+    const char *trace;
+    const char *only;
+};
+
+struct op_timer {
+    uint64_t count;
+    uint64_t ns;
+};
+
+static uint64_t timer_overhead_ns = 0;
+
+static inline uint64_t rng_next(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline void timer_add(struct op_timer *timer, uint64_t start, uint64_t end) {
+    uint64_t ns = end - start;
+    timer->ns += ns > timer_overhead_ns ? ns - timer_overhead_ns : 0;
+    timer->count++;
+}
+
+static double timer_avg(const struct op_timer *timer) {
+    return timer->count ? (double)timer->ns / (double)timer->count : 0.0;
+}
+
+static void calibrate_timer(void) {
+    uint64_t best = ~0ULL;
+    for (int i = 0; i < 10000; i++) {
+        uint64_t a = hosted_now_ns();
+        uint64_t b = hosted_now_ns();
+        if (b - a < best) best = b - a;
+    }
+    timer_overhead_ns = best;
+}
+
+static uint64_t parse_size(const char *text) {
+    char *end;
+    uint64_t value = strtoull(text, &end, 0);
+    switch (*end) {
+        case 'k': case 'K': return value << 10;
+        case 'm': case 'M': return value << 20;
+        case 'g': case 'G': return value << 30;
+        case 't': case 'T': return value << 40;
+        default: return value;
+    }
+}
+
+static void print_bytes(const char *label, uint64_t bytes) {
+    if (bytes >= (1ULL << 30)) printf("%s%.2f GiB", label, (double)bytes / (1ULL << 30));
+    else if (bytes >= (1ULL << 20)) printf("%s%.2f MiB", label, (double)bytes / (1ULL << 20));
+    else printf("%s%.2f KiB", label, (double)bytes / (1ULL << 10));
+}
+
+// Смесь размеров: в основном мелкие объекты slab, хвост до 1 MiB
+static size_t pick_size(uint64_t *rng) {
+    uint64_t r = rng_next(rng);
+    uint32_t bucket = r % 100;
+    r >>= 8;
+    if (bucket < 70) return 8 + r % 505;
+    if (bucket < 95) return 513 + r % 8192;
+    if (bucket < 99) return 8192 + r % 65536;
+    return 65536 + r % (1 << 20);
+}
+
+// ---------------------------------------------------------------- PMM
+
+static void bench_pmm(const struct bench_options *opt) {
+    uint64_t rng = opt->seed;
+    uint32_t slots = opt->live;
+    uint64_t *pages = calloc(slots, sizeof(uint64_t));
+    uint32_t *counts = calloc(slots, sizeof(uint32_t));
+    struct op_timer alloc1 = {0}, free1 = {0}, allocn = {0}, freen = {0};
+    uint64_t failed = 0;
+
+    for (uint64_t i = 0; i < opt->ops; i++) {
+        uint32_t slot = rng_next(&rng) % slots;
+        if (pages[slot]) {
+            uint64_t start = hosted_now_ns();
+            if (counts[slot] == 1) {
+                pmm_free_page(pages[slot]);
+                timer_add(&free1, start, hosted_now_ns());
+            } else {
+                pmm_free_pages(pages[slot], counts[slot]);
+                timer_add(&freen, start, hosted_now_ns());
+            }
+            pages[slot] = 0;
+            continue;
+        }
+
+        // 3/4 одиночных страниц (per-CPU кэш), остальное - блоки до 512 страниц
+        uint32_t count = rng_next(&rng) % 4 ? 1 : 1 + rng_next(&rng) % 512;
+        uint64_t start = hosted_now_ns();
+        uint64_t page = count == 1 ? pmm_alloc_page() : pmm_alloc_pages(count);
+        timer_add(count == 1 ? &alloc1 : &allocn, start, hosted_now_ns());
+        if (!page) {
+            failed++;
+            continue;
+        }
+        pages[slot] = page;
+        counts[slot] = count;
+    }
+
+    for (uint32_t i = 0; i < slots; i++) {
+        if (pages[i]) pmm_free_pages(pages[i], counts[i]);
+    }
+
+    printf("pmm:   alloc_page %.1f ns  free_page %.1f ns  alloc_pages %.1f ns  free_pages %.1f ns  (failed %lu)\n",
+           timer_avg(&alloc1), timer_avg(&free1), timer_avg(&allocn), timer_avg(&freen), failed);
+    free(pages);
+    free(counts);
+}
+
+// ---------------------------------------------------------------- heap
+
+struct heap_worker {
+    pthread_t thread;
+    uint32_t cpu;
+    const struct bench_options *opt;
+    struct op_timer alloc, free, realloc;
+    uint64_t failed;
+};
+
+static volatile uint64_t live_bytes = 0;
+static volatile uint64_t peak_live = 0;
+static volatile uint64_t peak_footprint = 0;
+static volatile uint64_t heap_at_peak = 0;
+static uint64_t footprint_base = 0;
+static uint64_t faults_base = 0;
+static uint64_t returned_base = 0;
+
+static uint64_t heap_pages_returned(void) {
+    uint64_t returned = 0;
+    heap_arena_stats_t stats;
+    for (uint32_t i = 0; i < HEAP_MAX_ARENAS; i++) {
+        if (heap_get_arena_stats(i, &stats)) returned += stats.pages_returned;
+    }
+    return returned;
+}
+
+static void reset_footprint(void) {
+    live_bytes = peak_live = peak_footprint = heap_at_peak = 0;
+    footprint_base = pmm_get_used_memory();
+    faults_base = hosted_fault_count();
+    returned_base = heap_pages_returned();
+}
+
+// footprint - физические страницы, взятые у PMM сверх состояния до теста
+static void sample_footprint(void) {
+    uint64_t now = pmm_get_used_memory();
+    uint64_t used = now > footprint_base ? now - footprint_base : 0;
+    uint64_t live = __atomic_load_n(&live_bytes, __ATOMIC_RELAXED);
+    if (used > peak_footprint) peak_footprint = used;
+    if (live > peak_live) {
+        peak_live = live;
+        heap_at_peak = heap_get_total_size();
+    }
+}
+
+static void *heap_worker_main(void *arg) {
+    struct heap_worker *w = arg;
+    const struct bench_options *opt = w->opt;
+    hosted_cpu_id = w->cpu;
+
+    uint64_t rng = opt->seed + w->cpu * 0x9E3779B97F4A7C15ULL;
+    uint32_t slots = opt->live / opt->threads;
+    void **ptrs = calloc(slots, sizeof(void *));
+    size_t *sizes = calloc(slots, sizeof(size_t));
+    uint64_t ops = opt->ops / opt->threads;
+
+    for (uint64_t i = 0; i < ops; i++) {
+        uint32_t slot = rng_next(&rng) % slots;
+        uint64_t action = rng_next(&rng) % 8;
+
+        if (!ptrs[slot]) {
+            size_t size = pick_size(&rng);
+            uint64_t start = hosted_now_ns();
+            void *ptr = kmalloc(size);
+            timer_add(&w->alloc, start, hosted_now_ns());
+            if (!ptr) {
+                w->failed++;
+                continue;
+            }
+            memset(ptr, 0xA5, size < 64 ? size : 64);
+            ptrs[slot] = ptr;
+            sizes[slot] = size;
+            __atomic_fetch_add(&live_bytes, size, __ATOMIC_RELAXED);
+        } else if (action == 0) {
+            size_t size = pick_size(&rng);
+            uint64_t start = hosted_now_ns();
+            void *ptr = krealloc(ptrs[slot], size);
+            timer_add(&w->realloc, start, hosted_now_ns());
+            if (!ptr) {
+                w->failed++;
+                continue;
+            }
+            __atomic_fetch_add(&live_bytes, size - sizes[slot], __ATOMIC_RELAXED);
+            ptrs[slot] = ptr;
+            sizes[slot] = size;
+        } else {
+            uint64_t start = hosted_now_ns();
+            kfree(ptrs[slot]);
+            timer_add(&w->free, start, hosted_now_ns());
+            __atomic_fetch_sub(&live_bytes, sizes[slot], __ATOMIC_RELAXED);
+            ptrs[slot] = NULL;
+        }
+
+        if (w->cpu == 0 && i % BENCH_SAMPLE_EVERY == 0) sample_footprint();
+    }
+
+    for (uint32_t i = 0; i < slots; i++) {
+        if (ptrs[i]) {
+            kfree(ptrs[i]);
+            __atomic_fetch_sub(&live_bytes, sizes[i], __ATOMIC_RELAXED);
+        }
+    }
+    free(ptrs);
+    free(sizes);
+    return NULL;
+}
+
+static void report_footprint(void) {
+    print_bytes("       peak footprint ", peak_footprint);
+    print_bytes(", peak live ", peak_live);
+    print_bytes(", heap at peak ", heap_at_peak);
+    // Доля арен кучи, не занятая живыми объектами в момент пика (мелочь из slab тоже считается живой)
+    double frag = heap_at_peak > peak_live ? 1.0 - (double)peak_live / (double)heap_at_peak : 0.0;
+    printf(", fragmentation %.1f%%\n", frag * 100.0);
+    printf("       pages returned to PMM %lu, heap page faults %lu\n",
+           heap_pages_returned() - returned_base, hosted_fault_count() - faults_base);
+}
+
+static void bench_heap(const struct bench_options *opt) {
+    struct heap_worker workers[BENCH_MAX_THREADS];
+    memset(workers, 0, sizeof(workers));
+    reset_footprint();
+
+    uint64_t start = hosted_now_ns();
+    for (uint32_t i = 0; i < opt->threads; i++) {
+        workers[i].cpu = i;
+        workers[i].opt = opt;
+        pthread_create(&workers[i].thread, NULL, heap_worker_main, &workers[i]);
+    }
+
+    struct op_timer alloc = {0}, release = {0}, realloc = {0};
+    uint64_t failed = 0;
+    for (uint32_t i = 0; i < opt->threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        alloc.count += workers[i].alloc.count;
+        alloc.ns += workers[i].alloc.ns;
+        release.count += workers[i].free.count;
+        release.ns += workers[i].free.ns;
+        realloc.count += workers[i].realloc.count;
+        realloc.ns += workers[i].realloc.ns;
+        failed += workers[i].failed;
+    }
+    uint64_t elapsed = hosted_now_ns() - start;
+
+    printf("heap:  %u thread(s), %.1f Mops/s  kmalloc %.1f ns  kfree %.1f ns  krealloc %.1f ns  (failed %lu)\n",
+           opt->threads, (double)(alloc.count + release.count + realloc.count) * 1e3 / (double)elapsed,
+           timer_avg(&alloc), timer_avg(&release), timer_avg(&realloc), failed);
+    report_footprint();
+}
+
+// ---------------------------------------------------------------- VMM
+
+static void bench_vmm(const struct bench_options *opt) {
+    struct op_timer create = {0}, map = {0}, unmap = {0}, destroy = {0};
+    uint64_t rounds = opt->ops / 1024 ? opt->ops / 1024 : 1;
+
+    for (uint64_t r = 0; r < rounds; r++) {
+        uint64_t start = hosted_now_ns();
+        vmm_space_t *space = vmm_create_space();
+        timer_add(&create, start, hosted_now_ns());
+        if (!space) break;
+
+        for (uint64_t i = 0; i < 512; i++) {
+            uint64_t phys = pmm_alloc_page();
+            if (!phys) break;
+            // Разреженные адреса: каждая страница в своей таблице PT через раз
+            uint64_t virt = BENCH_USER_BASE + i * (i & 1 ? PAGE_SIZE_2M : PAGE_SIZE_4K);
+            start = hosted_now_ns();
+            if (!vmm_map_page(space, virt, phys, PAGING_PRESENT | PAGING_WRITABLE | PAGING_USER)) {
+                pmm_free_page(phys);
+            }
+            timer_add(&map, start, hosted_now_ns());
+        }
+        for (uint64_t i = 0; i < 256; i++) {
+            uint64_t virt = BENCH_USER_BASE + i * (i & 1 ? PAGE_SIZE_2M : PAGE_SIZE_4K);
+            start = hosted_now_ns();
+            vmm_unmap_page(space, virt);
+            timer_add(&unmap, start, hosted_now_ns());
+        }
+
+        start = hosted_now_ns();
+        vmm_destroy_space(space);
+        timer_add(&destroy, start, hosted_now_ns());
+    }
+
+    printf("vmm:   create %.1f ns  map %.1f ns  unmap %.1f ns  destroy %.1f ns  (%lu spaces)\n",
+           timer_avg(&create), timer_avg(&map), timer_avg(&unmap), timer_avg(&destroy), create.count);
+}
+
+// ---------------------------------------------------------------- trace replay
+
+enum { TRACE_ALLOC = 1, TRACE_FREE, TRACE_REALLOC, TRACE_FAULT };
+
+struct trace_event {
+    uint64_t tsc;
+    uint64_t ptr;
+    uint64_t size;
+    uint32_t type;
+};
+
+struct trace_slot {
+    uint64_t key;       // 0 - пусто, 1 - удалено
+    void *ptr;
+    size_t size;
+};
+
+static struct trace_slot *trace_map = NULL;
+static uint64_t trace_map_mask = 0;
+
+static struct trace_slot *trace_lookup(uint64_t key, bool insert) {
+    struct trace_slot *tomb = NULL;
+    for (uint64_t i = (key * 0x9E3779B97F4A7C15ULL) & trace_map_mask;; i = (i + 1) & trace_map_mask) {
+        struct trace_slot *slot = &trace_map[i];
+        if (slot->key == key) return slot;
+        if (slot->key == 1 && !tomb) tomb = slot;
+        if (slot->key == 0) {
+            if (!insert) return NULL;
+            slot = tomb ? tomb : slot;
+            slot->key = key;
+            slot->ptr = NULL;
+            slot->size = 0;
+            return slot;
+        }
+    }
+}
+
+static int event_cmp(const void *a, const void *b) {
+    const struct trace_event *x = a, *y = b;
+    return x->tsc < y->tsc ? -1 : x->tsc > y->tsc;
+}
+
+// Формат - вывод alloc_trace_dump() с serial (лишние строки пропускаются)
+static struct trace_event *load_trace(const char *path, uint64_t *count) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+
+    uint64_t capacity = 4096, n = 0;
+    struct trace_event *events = malloc(capacity * sizeof(*events));
+    char line[256], type[16];
+    while (fgets(line, sizeof(line), file)) {
+        struct trace_event ev;
+        if (sscanf(line, " %lu %15s %*x %lx %lu", &ev.tsc, type, &ev.ptr, &ev.size) != 4) continue;
+
+        if (!strcmp(type, "alloc")) ev.type = TRACE_ALLOC;
+        else if (!strcmp(type, "free")) ev.type = TRACE_FREE;
+        else if (!strcmp(type, "realloc")) ev.type = TRACE_REALLOC;
+        else continue;
+
+        if (n == capacity) {
+            capacity *= 2;
+            events = realloc(events, capacity * sizeof(*events));
+        }
+        events[n++] = ev;
+    }
+    fclose(file);
+
+    // Кольца разных CPU сводим в одну временную шкалу
+    qsort(events, n, sizeof(*events), event_cmp);
+    *count = n;
+    return events;
+}
+
+static void bench_trace(const struct bench_options *opt) {
+    uint64_t count = 0;
+    struct trace_event *events = load_trace(opt->trace, &count);
+    if (!events) return;
+
+    uint64_t buckets = 16;
+    while (buckets < count * 2) buckets <<= 1;
+    trace_map = calloc(buckets, sizeof(struct trace_slot));
+    trace_map_mask = buckets - 1;
+
+    reset_footprint();
+    struct op_timer alloc = {0}, release = {0}, realloc = {0};
+    uint64_t skipped = 0;
+
+    for (uint64_t i = 0; i < count; i++) {
+        struct trace_event *ev = &events[i];
+        uint64_t key = ev->ptr < 2 ? ev->ptr + 2 : ev->ptr;
+        struct trace_slot *slot = trace_lookup(key, ev->type != TRACE_FREE);
+        uint64_t start = hosted_now_ns();
+
+        if (ev->type == TRACE_FREE) {
+            if (!slot) {
+                skipped++;
+                continue;
+            }
+            kfree(slot->ptr);
+            timer_add(&release, start, hosted_now_ns());
+            live_bytes -= slot->size;
+            slot->key = 1;
+            continue;
+        }
+
+        // Запись без пары (кольцо уже перезаписано) - считаем новым выделением
+        void *ptr;
+        if (slot->ptr) {
+            ptr = krealloc(slot->ptr, ev->size ? ev->size : 1);
+            timer_add(&realloc, start, hosted_now_ns());
+            live_bytes -= slot->size;
+        } else {
+            ptr = kmalloc(ev->size ? ev->size : 1);
+            timer_add(&alloc, start, hosted_now_ns());
+        }
+        slot->ptr = ptr;
+        slot->size = ptr ? ev->size : 0;
+        live_bytes += slot->size;
+        if (!ptr) slot->key = 1;
+
+        if (i % BENCH_SAMPLE_EVERY == 0) sample_footprint();
+    }
+    sample_footprint();
+
+    printf("trace: %lu events  kmalloc %.1f ns  kfree %.1f ns  krealloc %.1f ns  (unmatched frees %lu)\n",
+           count, timer_avg(&alloc), timer_avg(&release), timer_avg(&realloc), skipped);
+    report_footprint();
+
+    for (uint64_t i = 0; i <= trace_map_mask; i++) {
+        if (trace_map[i].key > 1 && trace_map[i].ptr) kfree(trace_map[i].ptr);
+    }
+    free(trace_map);
+    free(events);
+}
+
+// ----------------------------------------------------------------
+
+static void usage(const char *argv0) {
+    printf("usage: %s [options]\n"
+           "  --mem SIZE      simulated usable RAM, e.g. 512M, 64G, 2T (default 1G)\n"
+           "  --ops N         operations per benchmark (default 1000000)\n"
+           "  --live N        live objects / page slots (default 1024)\n"
+           "  --threads N     heap worker threads, one simulated CPU each (default 1)\n"
+           "  --seed N        RNG seed\n"
+           "  --trace FILE    replay an alloc_trace_dump() log captured from serial\n"
+           "  --only NAME     run only pmm, heap, vmm or trace\n"
+           "  --verbose       show kernel serial output\n", argv0);
+}
+
+static bool selected(const struct bench_options *opt, const char *name) {
+    return !opt->only || !strcmp(opt->only, name);
+}
+
+int main(int argc, char **argv) {
+    struct bench_options opt = {
+        .mem = 1ULL << 30,
+        .ops = 1000000,
+        .live = 1024,
+        .threads = 1,
+        .seed = 0x0DEE12024ULL,
+    };
+
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(arg, "--verbose")) {
+            hosted_verbose = true;
+            continue;
+        }
+        if (!strcmp(arg, "--help")) {
+            usage(argv[0]);
+            return 0;
+        }
+        if (!value) {
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (!strcmp(arg, "--mem")) opt.mem = parse_size(value);
+        else if (!strcmp(arg, "--ops")) opt.ops = strtoull(value, NULL, 0);
+        else if (!strcmp(arg, "--live")) opt.live = (uint32_t)strtoul(value, NULL, 0);
+        else if (!strcmp(arg, "--threads")) opt.threads = (uint32_t)strtoul(value, NULL, 0);
+        else if (!strcmp(arg, "--seed")) opt.seed = strtoull(value, NULL, 0) | 1;
+        else if (!strcmp(arg, "--trace")) opt.trace = value;
+        else if (!strcmp(arg, "--only")) opt.only = value;
+        else { usage(argv[0]); return 1; }
+        i++;
+    }
+    if (opt.threads < 1) opt.threads = 1;
+    if (opt.threads > BENCH_MAX_THREADS) opt.threads = BENCH_MAX_THREADS;
+    if (opt.live < opt.threads) opt.live = opt.threads;
+
+    struct hosted_boot_info info;
+    if (!hosted_boot(opt.mem, &info)) {
+        fprintf(stderr, "hosted boot failed\n");
+        return 1;
+    }
+    calibrate_timer();
+
+    print_bytes("boot:  usable ", info.usable_bytes);
+    print_bytes(", phys end ", info.phys_end);
+    printf(", pmm_init %.2f ms, boot %.2f ms\n", info.pmm_init_ns / 1e6, info.boot_ns / 1e6);
+
+    if (selected(&opt, "pmm")) bench_pmm(&opt);
+    if (selected(&opt, "heap")) bench_heap(&opt);
+    if (selected(&opt, "vmm")) bench_vmm(&opt);
+    if (opt.trace && selected(&opt, "trace")) bench_trace(&opt);
+    return 0;
+}
@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+
+#include "machine.h"
+#include "include/sys/hosted.h"
+#include "include/sys/smp.h"
+#include "include/memory/pmm.h"
+#include "include/memory/paging.h"
+#include "include/memory/heap.h"
+#include "include/memory/slab.h"
+#include "include/memory/vmm.h"
+#include "include/interrupts/isr.h"
+
+#define HOSTED_MAX_ENTRIES 8
+#define GIB (1ULL << 30)
+
+void handle_page_fault(struct registers *regs);
+
+__thread uint32_t hosted_cpu_id = 0;
+static __thread uint64_t cr2_value = 0;
+static uint64_t cr3_value = 0;
+
+bool hosted_verbose = false;
+struct smp_state smp_state;
+
+static volatile uint64_t fault_count = 0;
+static int phys_fd = -1;
+static uint8_t *phys_base = NULL;
+
+static struct limine_memmap_entry entries[HOSTED_MAX_ENTRIES];
+static struct limine_memmap_entry *entry_ptrs[HOSTED_MAX_ENTRIES];
+static struct limine_memmap_response memmap = { .revision = 0, .entry_count = 0, .entries = entry_ptrs };
+static struct limine_hhdm_response hhdm = { .revision = 0, .offset = 0 };
+
+void serial_puts(const char *str) {
+    if (hosted_verbose) fputs(str, stderr);
+}
+
+uint64_t hosted_read_cr3(void) {
+    return cr3_value;
+}
+
+void hosted_write_cr3(uint64_t cr3) {
+    cr3_value = cr3;
+}
+
+uint64_t hosted_read_cr2(void) {
+    return cr2_value;
+}
+
+void hosted_halt(void) {
+    fflush(stdout);
+    fprintf(stderr, "[HOSTED] Kernel code halted the machine\n");
+    abort();
+}
+
+uint64_t hosted_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline bool in_heap_window(uint64_t virtual_addr) {
+    return virtual_addr >= HEAP_START && virtual_addr < HEAP_START + HEAP_MAX_SIZE;
+}
+
+static inline bool is_current_pml4(const void *pml4) {
+    return (const uint8_t *)pml4 == phys_base + (cr3_value & PAGING_ADDR_MASK);
+}
+
+// Страница кучи становится тем же кадром memfd, что виден через HHDM
+void hosted_page_mapped(const void *pml4, uint64_t virtual_addr, uint64_t physical_addr, uint64_t size) {
+    if (!is_current_pml4(pml4) || !in_heap_window(virtual_addr)) return;
+
+    if (mmap((void *)virtual_addr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             phys_fd, (off_t)physical_addr) == MAP_FAILED) {
+        perror("[HOSTED] mmap heap page");
+        hosted_halt();
+    }
+}
+
+void hosted_page_unmapped(const void *pml4, uint64_t virtual_addr, uint64_t size) {
+    if (!is_current_pml4(pml4) || !in_heap_window(virtual_addr)) return;
+
+    if (mmap((void *)virtual_addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE,
+             -1, 0) == MAP_FAILED) {
+        perror("[HOSTED] unmap heap page");
+        hosted_halt();
+    }
+}
+
+// SIGSEGV в окне кучи - это page fault ядра: отдаём его обработчику из paging.c
+static void fault_handler(int sig, siginfo_t *info, void *context) {
+    (void)sig;
+    ucontext_t *uc = context;
+    uint64_t address = (uint64_t)info->si_addr;
+
+    struct registers regs;
+    memset(&regs, 0, sizeof(regs));
+    regs.rip = (uint64_t)uc->uc_mcontext.gregs[REG_RIP];
+    regs.err_code = (uint64_t)uc->uc_mcontext.gregs[REG_ERR] & 0x2;
+    if (!in_heap_window(address) || paging_is_mapped(address)) regs.err_code |= 0x1;
+
+    cr2_value = address;
+    __atomic_fetch_add(&fault_count, 1, __ATOMIC_RELAXED);
+    handle_page_fault(&regs);
+}
+
+uint64_t hosted_fault_count(void) {
+    return fault_count;
+}
+
+static void add_entry(uint64_t base, uint64_t length, uint64_t type) {
+    struct limine_memmap_entry *entry = &entries[memmap.entry_count];
+    entry->base = base;
+    entry->length = length;
+    entry->type = type;
+    entry_ptrs[memmap.entry_count++] = entry;
+}
+
+// Раскладка как у типичного PC: дыра под BIOS, ядро на 1 MiB, PCI-дыра 3-4 GiB
+static uint64_t build_memmap(uint64_t usable_bytes) {
+    memmap.entry_count = 0;
+    add_entry(0x0, 0x1000, LIMINE_MEMMAP_RESERVED);
+    add_entry(0x1000, 0x9E000, LIMINE_MEMMAP_USABLE);
+    add_entry(0x9F000, 0x61000, LIMINE_MEMMAP_RESERVED);
+    add_entry(0x100000, 0x100000, LIMINE_MEMMAP_EXECUTABLE_AND_MODULES);
+
+    uint64_t remaining = usable_bytes > 0x9E000 ? usable_bytes - 0x9E000 : 0;
+    uint64_t low = remaining < 3 * GIB - 0x200000 ? remaining : 3 * GIB - 0x200000;
+    low &= ~0xFFFULL;
+    add_entry(0x200000, low, LIMINE_MEMMAP_USABLE);
+    remaining -= low;
+
+    if (remaining < 0x1000) return 0x200000 + low;
+
+    add_entry(3 * GIB, GIB, LIMINE_MEMMAP_RESERVED);
+    remaining &= ~0xFFFULL;
+    add_entry(4 * GIB, remaining, LIMINE_MEMMAP_USABLE);
+    return 4 * GIB + remaining;
+}
+
+bool hosted_boot(uint64_t usable_bytes, struct hosted_boot_info *info) {
+    uint64_t phys_end = build_memmap(usable_bytes);
+
+    phys_fd = memfd_create("deer-phys", 0);
+    if (phys_fd < 0 || ftruncate(phys_fd, (off_t)phys_end) != 0) {
+        perror("[HOSTED] memfd");
+        return false;
+    }
+
+    phys_base = mmap(NULL, phys_end, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, phys_fd, 0);
+    if (phys_base == MAP_FAILED) {
+        perror("[HOSTED] mmap physical memory");
+        return false;
+    }
+    hhdm.offset = (uint64_t)phys_base;
+
+    if (mmap((void *)HEAP_START, HEAP_MAX_SIZE, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0) != (void *)HEAP_START) {
+        perror("[HOSTED] reserve heap window");
+        return false;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = fault_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, NULL);
+
+    uint64_t start = hosted_now_ns();
+    pmm_init(&memmap, &hhdm);
+    uint64_t pmm_done = hosted_now_ns();
+
+    cr3_value = pmm_alloc_zeroed_page();
+    if (!cr3_value) return false;
+
+    paging_init(&hhdm);
+    heap_init();
+    slab_init();
+    vmm_init(&hhdm);
+    uint64_t done = hosted_now_ns();
+
+    if (info) {
+        info->usable_bytes = 0;
+        for (uint64_t i = 0; i < memmap.entry_count; i++) {
+            if (entries[i].type == LIMINE_MEMMAP_USABLE) info->usable_bytes += entries[i].length;
+        }
+        info->phys_end = phys_end;
+        info->pmm_init_ns = pmm_done - start;
+        info->boot_ns = done - start;
+    }
+    return true;
+}
@@ -0,0 +1,25 @@
+#ifndef HOSTED_MACHINE_H
+#define HOSTED_MACHINE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Симулированная машина для хостовой сборки: физическая память - memfd,
+// HHDM - отображение всего memfd, окно кучи отражает листовые записи PML4
+
+struct hosted_boot_info {
+    uint64_t usable_bytes;      // сумма USABLE-регионов memmap
+    uint64_t phys_end;          // верхняя граница физического адреса
+    uint64_t pmm_init_ns;
+    uint64_t boot_ns;           // pmm + paging + heap + slab + vmm
+};
+
+extern bool hosted_verbose;
+
+bool hosted_boot(uint64_t usable_bytes, struct hosted_boot_info *info);
+uint64_t hosted_now_ns(void);
+
+// Page fault в окне кучи стоит здесь сигнала и mmap - на порядок дороже, чем в ядре
+uint64_t hosted_fault_count(void);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef ALLOC_TRACE_H
+#define ALLOC_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Трассировка включается при сборке: python3 build.py --heap-trace (-DHEAP_TRACE)
+#define ALLOC_TRACE_CPUS        16      // CPU с большим номером делят кольцо по модулю
+#define ALLOC_TRACE_RING_SIZE   512     // записей на CPU, степень двойки
+#define ALLOC_TRACE_SITES       256     // мест вызова в сводке, степень двойки
+#define ALLOC_TRACE_TOP         16
+
+enum alloc_trace_type {
+    ALLOC_TRACE_ALLOC = 1,
+    ALLOC_TRACE_FREE,
+    ALLOC_TRACE_REALLOC,
+    ALLOC_TRACE_FAULT,      // страница кучи подставлена обработчиком page fault
+};
+
+// Фиксированная двоичная запись, 32 байта
+struct alloc_trace_record {
+    uint64_t tsc;
+    uint64_t rip;
+    uint64_t ptr;
+    uint32_t size;
+    uint8_t type;
+    uint8_t cpu;
+    uint16_t reserved;
+};
+
+struct alloc_trace_site {
+    uint64_t rip;
+    uint64_t allocs;
+    uint64_t bytes;
+};
+
+static inline uint64_t alloc_trace_tsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+void alloc_trace_record(uint8_t type, uint64_t rip, const void *ptr, size_t size);
+bool alloc_trace_enabled(void);
+void alloc_trace_dump(void);
+void alloc_trace_dump_sites(void);
+void alloc_trace_reset(void);
+
+#ifdef HEAP_TRACE
+#define ALLOC_TRACE(type, ptr, size) \
+    alloc_trace_record((type), (uint64_t)__builtin_return_address(0), (ptr), (size))
+#define ALLOC_TRACE_AT(type, rip, ptr, size) \
+    alloc_trace_record((type), (rip), (ptr), (size))
+#else
+#define ALLOC_TRACE(type, ptr, size) ((void)0)
+#define ALLOC_TRACE_AT(type, rip, ptr, size) ((void)0)
+#endif
+
+#endif
@@ -4,27 +4,72 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include "../sys/spinlock.h"
 
+#ifdef DEER_HOSTED
+#define HEAP_START         0x0000600000000000   // хостовая сборка: адрес пользовательского процесса
+#else
 #define HEAP_START         0xFFFFFFFF90000000
-#define HEAP_INITIAL_SIZE  0x100000
+#endif
+#define HEAP_INITIAL_SIZE  0x200000
 #define HEAP_MAX_SIZE      0x4000000
 #define HEAP_ALIGNMENT     8
 
+// Каждая арена владеет своим куском виртуального диапазона кучи
+#define HEAP_MAX_ARENAS    8
+#define HEAP_ARENA_SIZE    (HEAP_MAX_SIZE / HEAP_MAX_ARENAS)
+#define HEAP_GROW_CHUNK    0x200000    // рост арены кусками по 2 MiB
+#define HEAP_TRIM_THRESHOLD 0x100000   // свободные блоки крупнее отдают страницы в PMM
+
+// TLSF: первый уровень - степень двойки, второй - HEAP_SL_COUNT линейных поддиапазонов
+#define HEAP_SL_LOG2       4
+#define HEAP_SL_COUNT      (1 << HEAP_SL_LOG2)
+#define HEAP_FL_SHIFT      (HEAP_SL_LOG2 + 3)          // 3 = log2(HEAP_ALIGNMENT)
+#define HEAP_SMALL_BLOCK   (1 << HEAP_FL_SHIFT)        // меньше - одна линейная шкала
+#define HEAP_FL_MAX        27                          // блоки до 128 MiB
+#define HEAP_FL_COUNT      (HEAP_FL_MAX - HEAP_FL_SHIFT + 1)
+#define HEAP_MIN_BLOCK     (2 * sizeof(void*))         // место под ссылки свободного списка
+
 typedef struct heap_block {
     size_t size;
     bool used;
+    uint8_t arena;
     struct heap_block* next;
     struct heap_block* prev;
 } heap_block_t;
 
 typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t remote_frees;      // освобождено чужим CPU через очередь
+    uint64_t remote_drained;
+    uint64_t lock_contended;    // захват блокировки арены не удался с первой попытки
+    uint64_t foreign_allocs;    // своя арена пуста, блок взят у соседа
+    uint64_t grows;
+    uint64_t pages_returned;
+    uint64_t grows_in_place;    // krealloc расширил блок без копирования
+    uint64_t shrinks_in_place;
+} heap_arena_stats_t;
+
+typedef struct {
+    spinlock_t lock;
+    bool initialized;
+    uint8_t id;
+    heap_block_t* volatile remote_free;
+    heap_arena_stats_t stats;
+
     void* start;
     void* end;
     size_t total_size;
     size_t used_size;
     size_t block_count;
     heap_block_t* first_block;
-} heap_t;
+    heap_block_t* last_block;
+
+    uint32_t fl_bitmap;
+    uint32_t sl_bitmap[HEAP_FL_COUNT];
+    heap_block_t* free_lists[HEAP_FL_COUNT][HEAP_SL_COUNT];
+} __attribute__((aligned(64))) heap_t;
 
 void heap_init(void);
 void* kmalloc(size_t size);
@@ -36,5 +81,7 @@ size_t heap_get_total_size(void);
 size_t heap_get_used_size(void);
 size_t heap_get_free_size(void);
 void heap_dump_blocks(void);
+bool heap_get_arena_stats(uint32_t arena, heap_arena_stats_t* stats);
+void heap_dump_arena_stats(void);
 
 #endif
\ No newline at end of file
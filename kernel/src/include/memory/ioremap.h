@@ -0,0 +1,19 @@
+#ifndef IOREMAP_H
+#define IOREMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum ioremap_cache {
+    IOREMAP_WB,
+    IOREMAP_WC,     // кадровый буфер: записи собираются в пакеты
+    IOREMAP_UC,     // регистры устройств
+    IOREMAP_WT,
+};
+
+// Отображает физический диапазон в HHDM с нужным типом памяти. Запись
+// загрузчика по тому же адресу заменяется, второго алиаса не появляется
+void* ioremap(uint64_t phys, uint64_t size, enum ioremap_cache cache);
+void iounmap(void* addr, uint64_t size);
+
+#endif
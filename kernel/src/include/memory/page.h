@@ -0,0 +1,80 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "pmm.h"
+
+// Состояние кадра для buddy-аллокатора
+#define PAGE_STATE_USABLE  0x80
+#define PAGE_STATE_FREE    0x40   // только у головы свободного блока
+#define PAGE_STATE_ORDER   0x1F
+
+// Флаги владельца; PMM сбрасывает их при освобождении кадра
+#define PAGE_FLAG_TABLE    (1U << 0)   // таблица страниц
+#define PAGE_FLAG_ANON     (1U << 1)   // mapping - vmm_space_t, index - виртуальный адрес
+#define PAGE_FLAG_FILE     (1U << 2)   // mapping - struct vma_file, index - смещение
+#define PAGE_FLAG_LRU      (1U << 3)   // кадр в одном из page_list
+#define PAGE_FLAG_DIRTY    (1U << 4)
+#define PAGE_FLAG_PINNED   (1U << 5)   // не вытесняется (DMA, zero-copy буферы)
+
+#define PAGE_PFN_NONE      0   // кадр 0 никогда не выдаётся
+
+// Описатель физического кадра: 32 байта, два на строку кэша
+struct page {
+    uint32_t refs;          // владельцев сверх первого (COW, разделяемая память)
+    uint8_t state;
+    uint8_t node;           // NUMA-узел
+    uint16_t flags;
+    uint64_t mapping;
+    uint64_t index;
+    uint32_t lru_next;      // pfn соседей в page_list
+    uint32_t lru_prev;
+};
+
+_Static_assert(sizeof(struct page) == 32, "struct page must stay 32 bytes");
+
+// Список кадров для LRU; блокировка - на владельце списка
+struct page_list {
+    uint32_t head;          // самый свежий
+    uint32_t tail;          // кандидат на вытеснение
+    uint64_t count;
+};
+
+extern struct page *pmm_pages;
+extern uint64_t pmm_page_count;
+
+static inline struct page *pfn_to_page(uint64_t pfn) {
+    return pfn < pmm_page_count ? &pmm_pages[pfn] : NULL;
+}
+
+static inline uint64_t page_to_pfn(const struct page *page) {
+    return (uint64_t)(page - pmm_pages);
+}
+
+static inline struct page *phys_to_page(uint64_t phys) {
+    return pfn_to_page(phys / PAGE_SIZE);
+}
+
+static inline uint64_t page_to_phys(const struct page *page) {
+    return page_to_pfn(page) * PAGE_SIZE;
+}
+
+static inline uint32_t page_owners(const struct page *page) {
+    return __atomic_load_n(&page->refs, __ATOMIC_ACQUIRE) + 1;
+}
+
+// Учёт владельца кадра для обратного поиска отображений
+static inline void page_set_owner(struct page *page, uint16_t flags, uint64_t mapping, uint64_t index) {
+    page->flags = (page->flags & (PAGE_FLAG_LRU | PAGE_FLAG_PINNED)) | flags;
+    page->mapping = mapping;
+    page->index = index;
+}
+
+void page_list_add(struct page_list *list, struct page *page);
+void page_list_del(struct page_list *list, struct page *page);
+void page_list_rotate(struct page_list *list, struct page *page);   // снова в голову
+struct page *page_list_pop(struct page_list *list);                 // хвост или NULL
+
+#endif
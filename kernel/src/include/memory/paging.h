@@ -17,9 +17,26 @@ struct registers;
 #define PAGING_DIRTY           (1ULL << 6)
 #define PAGING_HUGE_PAGE       (1ULL << 7)
 #define PAGING_GLOBAL          (1ULL << 8)
+#define PAGING_COW             (1ULL << 9)    // программный бит: запись разделяет кадр
+#define PAGING_MMIO            (1ULL << 10)   // программный бит: кадр не из PMM, не освобождается
 #define PAGING_NO_EXECUTE      (1ULL << 63)
 
 #define PAGE_SIZE_4K 0x1000
+#define PAGE_SIZE_2M 0x200000ULL
+#define PAGE_SIZE_1G 0x40000000ULL
+
+#define PAGING_ADDR_MASK       0x000FFFFFFFFFF000ULL
+#define PAGING_KERNEL_HALF     0xFFFF800000000000ULL   // общая для всех пространств, листья глобальные
+#define PAGING_PAT_LARGE       (1ULL << 12)   // бит PAT в записях 2 MiB / 1 GiB
+#define PAGING_USER_END        0x0000800000000000ULL
+#define PAGING_PAT_4K          (1ULL << 7)    // бит PAT в записях 4 KiB (на месте PS)
+
+// Типы памяти через PAT: PA0-PA3 как после сброса, PA4 = WC. В flags бит PAT
+// всегда задаётся как PAGING_PAT_LARGE, для листьев 4 KiB он переносится в бит 7
+#define PAGING_CACHE_WB        0
+#define PAGING_CACHE_WT        PAGING_WRITE_THROUGH
+#define PAGING_CACHE_UC        (PAGING_CACHE_DISABLE | PAGING_WRITE_THROUGH)
+#define PAGING_CACHE_WC        PAGING_PAT_LARGE
 
 typedef uint64_t page_table_entry_t;
 
@@ -28,14 +45,42 @@ typedef struct page_table {
 } __attribute__((aligned(PAGE_SIZE_4K))) page_table_t;
 
 void paging_init(volatile struct limine_hhdm_response *hhdm_response);
+void paging_init_cpu(void);   // CR4.PGE и CR4.PCIDE на текущем CPU
+bool paging_pcid_enabled(void);
+bool paging_pat_enabled(void);
 void paging_load_cr3(uint64_t cr3_value);
 uint64_t paging_get_cr3(void);
 void paging_invalidate_tlb(uint64_t virtual_addr);
+void paging_invalidate_tlb_range(uint64_t virtual_addr, uint64_t size);
+void paging_flush_tlb(void);
 
 bool paging_map_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags);
+bool paging_map_large_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t page_size, uint64_t flags);
 bool paging_unmap_page(uint64_t virtual_addr);
 bool paging_is_mapped(uint64_t virtual_addr);
 uint64_t paging_get_physical_address(uint64_t virtual_addr);
+uint64_t paging_get_page_size(uint64_t virtual_addr);
+
+// Диапазоны: каждая таблица обходится один раз, где позволяет выравнивание
+// ставятся страницы 2 MiB / 1 GiB, TLB сбрасывается один раз в конце.
+// unmap возвращает кадры в PMM и сообщает их число в 4 KiB страницах
+bool paging_map_range(uint64_t virtual_addr, uint64_t physical_addr, uint64_t size, uint64_t flags);
+uint64_t paging_unmap_range(uint64_t virtual_addr, uint64_t size);
+
+// Те же операции над произвольным PML4 (используются VMM)
+bool paging_map_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t physical_addr,
+                   uint64_t page_size, uint64_t flags);
+bool paging_unmap_in(page_table_t* pml4, uint64_t virtual_addr);
+bool paging_map_range_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t physical_addr,
+                         uint64_t size, uint64_t flags);
+uint64_t paging_unmap_range_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t size);
+page_table_entry_t* paging_lookup_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t* page_size);
+// Для обработчиков #PF: false, если страница уже отображена (другим CPU) или нет памяти
+bool paging_map_absent_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags);
+
+// Копирует таблицы нижней половины src в dst. Кадры не копируются: обе
+// стороны ссылаются на них только для чтения, запись разделяется в #PF
+bool paging_clone_user_in(page_table_t* dst, page_table_t* src);
 
 void* paging_physical_to_virtual(uint64_t physical_addr);
 uint64_t paging_virtual_to_physical(void* virtual_addr);
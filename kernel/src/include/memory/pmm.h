@@ -7,16 +7,62 @@
 #include <limine.h>
 
 #define PAGE_SIZE 0x1000
+#define PMM_MAX_ORDER 18   // 2^18 страниц = 1 GiB
+#define PMM_MAX_NODES 8
+
+#define PMM_PCP_SIZE  64   // ёмкость магазина одного CPU (степень двойки)
+#define PMM_PCP_BATCH 16   // сколько страниц брать/отдавать глобальному аллокатору за раз
+
+#define PMM_ZERO_POOL_SIZE  256  // обнулённых страниц про запас (1 MiB)
+#define PMM_ZERO_POOL_BATCH 8    // сколько страниц обнулять за один проход idle
+
+struct pmm_zero_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t zeroed;
+    uint32_t pooled;
+};
+
+struct pmm_pcp_stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t frees;
+    uint64_t refills;
+    uint64_t drains;
+    uint32_t cached;
+};
 
 void pmm_init(volatile struct limine_memmap_response *memmap_response,
               volatile struct limine_hhdm_response *hhdm_response);
 uint64_t pmm_alloc_page(void);
+uint64_t pmm_alloc_zeroed_page(void);
 void pmm_free_page(uint64_t page);
+void pmm_free_page_cold(uint64_t page);
 uint64_t pmm_alloc_pages(size_t count);
+uint64_t pmm_alloc_pages_node(size_t count, uint8_t node);
+uint64_t pmm_alloc_pages_aligned(size_t count, uint64_t alignment);
 void pmm_free_pages(uint64_t page, size_t count);
+
+// Разделяемые кадры: +1 владелец каждому, каждый pmm_free_* снимает одного.
+// Счётчики и владельцы - в struct page (page.h)
+bool pmm_share_pages(uint64_t page, size_t count);
 uint64_t pmm_get_total_memory(void);
 uint64_t pmm_get_free_memory(void);
 uint64_t pmm_get_used_memory(void);
 void pmm_dump_memory_map(void);
+void pmm_dump_free_lists(void);
+
+uint32_t pmm_get_node_count(void);
+uint64_t pmm_get_node_free_memory(uint8_t node);
+void pmm_set_node_range(uint64_t base, uint64_t length, uint8_t node);
+void pmm_set_node_fallback(uint8_t node, const uint8_t *order, uint32_t count);
+void pmm_numa_rebalance(void);
+
+void pmm_pcp_drain(void);
+bool pmm_get_pcp_stats(uint32_t cpu, struct pmm_pcp_stats *stats);
+void pmm_dump_pcp_stats(void);
+
+uint32_t pmm_zero_pool_refill(uint32_t budget);
+void pmm_get_zero_stats(struct pmm_zero_stats *stats);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "../sys/spinlock.h"
+
+#define KMEM_CACHE_LINE     64
+#define KMEM_NAME_LEN       32
+#define KMEM_SLAB_MAGIC     0x51AB51AB
+#define KMEM_MAX_SLAB_PAGES 8      // больше - уже не "мелкие" объекты
+#define KMEM_MIN_OBJECTS    4      // меньше объектов в slab-е - увеличиваем slab
+
+// Классы kmalloc, которые обслуживает slab (остальное - куча)
+#define KMALLOC_MIN_SHIFT   4      // 16 байт
+#define KMALLOC_MAX_SHIFT   9      // 512 байт
+#define KMALLOC_SLAB_MAX    (1UL << KMALLOC_MAX_SHIFT)
+
+typedef void (*kmem_ctor_t)(void *obj);
+
+// Заголовок лежит в начале slab-а, slab выровнен на свой размер
+struct kmem_slab {
+    struct kmem_cache *cache;
+    struct kmem_slab *next;
+    struct kmem_slab *prev;
+    void *free_list;
+    uint32_t in_use;
+    uint32_t magic;
+};
+
+struct kmem_cache {
+    char name[KMEM_NAME_LEN];
+    size_t object_size;
+    size_t stride;
+    size_t align;
+    size_t free_offset;        // где в свободном объекте хранится ссылка на следующий
+    uint32_t objects_per_slab;
+    uint32_t slab_pages;
+    kmem_ctor_t ctor;
+    spinlock_t lock;
+
+    struct kmem_slab *partial;
+    struct kmem_slab *full;
+    struct kmem_slab *empty;
+
+    uint64_t slab_count;
+    uint64_t active_objects;
+    uint64_t total_allocs;
+    uint64_t total_frees;
+
+    struct kmem_cache *next;
+};
+
+void slab_init(void);
+bool slab_is_ready(void);
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor);
+void kmem_cache_destroy(struct kmem_cache *cache);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+void kmem_cache_shrink(struct kmem_cache *cache);
+
+// Для kmalloc/kfree: маленькие размеры и освобождение по адресу
+void *kmem_alloc_small(size_t size);
+bool kmem_free_small(void *ptr);
+size_t kmem_object_size(const void *ptr);
+
+void kmem_dump_caches(void);
+
+#endif
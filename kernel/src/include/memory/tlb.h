@@ -0,0 +1,77 @@
+#ifndef TLB_H
+#define TLB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "paging.h"
+#include "../sys/smp.h"
+
+struct registers;
+
+#define TLB_SHOOTDOWN_VECTOR 0xF0
+#define TLB_QUEUE_SIZE       16   // диапазонов в очереди CPU, дальше - полный сброс
+#define TLB_GATHER_FRAMES    32   // кадров, ждущих сброса TLB перед возвратом в PMM
+
+#define TLB_PCID_COUNT       4096  // PCID 0 остаётся за CR3 загрузчика
+#define TLB_CR3_NOFLUSH      (1ULL << 63)
+
+struct tlb_stats {
+    uint64_t shootdowns;      // вызовов, затронувших другие CPU
+    uint64_t ipis_sent;
+    uint64_t ipis_received;   // обработанных очередей (IPI или опрос в ожидании)
+    uint64_t full_flushes;
+    uint64_t ranges_flushed;
+    uint64_t pcid_hits;       // смена CR3 без сброса TLB
+    uint64_t pcid_flushes;    // смена CR3 со сбросом PCID
+    uint64_t lazy_flushes;    // shootdown без IPI: CPU сбросит PCID при входе
+};
+
+struct tlb_gather_frame {
+    uint64_t phys;
+    uint64_t pages;
+};
+
+// Адресное пространство с PCID. Записи TLB с этим PCID переживают смену CR3,
+// поэтому shootdown должен знать и CPU, где пространство сейчас не активно:
+// им сбрасывается бит в cpu_mask, и при следующем входе PCID будет сброшен
+struct tlb_context {
+    uint64_t pml4_phys;
+    uint64_t generation;
+    uint16_t pcid;
+    volatile uint64_t cpu_mask[MAX_CPUS / 64];
+    struct tlb_context *next;
+};
+
+// Снятые, но ещё не сброшенные отображения. Кадры нельзя отдавать в PMM,
+// пока на других CPU могут жить старые трансляции
+struct tlb_gather {
+    page_table_t* pml4;
+    uint64_t start;
+    uint64_t end;
+    uint64_t freed_pages;
+    uint32_t frame_count;
+    struct tlb_gather_frame frames[TLB_GATHER_FRAMES];
+};
+
+void tlb_init(void);
+void tlb_set_active(uint64_t cr3);
+void tlb_shootdown(page_table_t* pml4, uint64_t virtual_addr, uint64_t size);
+void tlb_poll(void);
+void tlb_shootdown_handler(struct registers *regs);
+
+void tlb_context_init(struct tlb_context *ctx, uint64_t pml4_phys);
+void tlb_context_destroy(struct tlb_context *ctx);
+uint64_t tlb_context_switch(struct tlb_context *ctx);   // значение для CR3
+
+void tlb_gather_init(struct tlb_gather *gather, page_table_t* pml4);
+void tlb_gather_add(struct tlb_gather *gather, uint64_t virtual_addr, uint64_t size, uint64_t phys);
+void tlb_gather_flush(struct tlb_gather *gather);
+
+static inline bool tlb_gather_full(const struct tlb_gather *gather) {
+    return gather->frame_count == TLB_GATHER_FRAMES;
+}
+
+bool tlb_get_stats(uint32_t cpu, struct tlb_stats *stats);
+void tlb_dump_stats(void);
+
+#endif
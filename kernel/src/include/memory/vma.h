@@ -0,0 +1,58 @@
+#ifndef VMA_H
+#define VMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define VMA_STACK_GAP (64 * 1024)   // насколько ниже уже отображённого стека допустим доступ
+
+enum vma_type {
+    VMA_ANON,       // обнулённые страницы по требованию
+    VMA_FILE,       // страницы заполняет read_page
+    VMA_STACK,      // растёт вниз, нижняя страница - защитная
+    VMA_DEVICE,     // физический диапазон устройства, кадры не из PMM
+};
+
+struct vma_file {
+    // Заполняет страницу содержимым по смещению offset; false - ошибка чтения
+    bool (*read_page)(void *ctx, uint64_t offset, void *page);
+    void *ctx;
+};
+
+struct vma {
+    uint64_t start;
+    uint64_t end;
+    uint64_t flags;             // флаги листьев PAGING_*
+    enum vma_type type;
+    union {
+        struct {
+            const struct vma_file *file;
+            uint64_t offset;
+        } file;
+        uint64_t stack_low;     // нижняя отображённая страница стека
+        uint64_t phys;          // начало диапазона устройства
+    };
+
+    struct vma *left;
+    struct vma *right;
+    int32_t height;
+};
+
+// AVL-дерево непересекающихся областей, упорядоченных по start.
+// Блокировки - на вызывающем (vmm_space_t::area_lock)
+struct vma_tree {
+    struct vma *root;
+    struct vma *last_hit;       // повторные промахи обычно приходят в ту же область
+    uint64_t count;
+    uint64_t lookups;
+    uint64_t cache_hits;
+};
+
+void vma_tree_init(struct vma_tree *tree);
+bool vma_tree_insert(struct vma_tree *tree, struct vma *vma);   // false при пересечении
+void vma_tree_remove(struct vma_tree *tree, struct vma *vma);
+struct vma *vma_tree_find(struct vma_tree *tree, uint64_t addr);
+struct vma *vma_tree_next(struct vma_tree *tree, uint64_t addr);   // первая с end > addr
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define VMALLOC_START      0xFFFFFFFFA0000000
+#define VMALLOC_SIZE       0x10000000          // 256 MiB
+#define VMALLOC_END        (VMALLOC_START + VMALLOC_SIZE)
+#define VMALLOC_GUARD_SIZE 0x1000              // неотображённая страница с каждой стороны
+
+#define VMALLOC_ZERO       (1 << 0)            // обнулённые страницы
+#define VMALLOC_LARGE      (1 << 1)            // 2 MiB страницы, где возможно
+
+struct vm_area {
+    uint64_t start;          // начало резерва, включая нижнюю guard-страницу
+    uint64_t size;           // размер резерва целиком
+    uint64_t addr;           // адрес, выданный вызывающему
+    uint64_t length;         // отображённая часть
+    uint32_t flags;
+    struct vm_area *next;
+};
+
+void vmalloc_init(void);
+void* vmalloc(size_t size);
+void* vmalloc_flags(size_t size, uint32_t flags);
+void vfree(void* ptr);
+bool vmalloc_is_guard(uint64_t addr);
+void vmalloc_dump(void);
+
+#endif
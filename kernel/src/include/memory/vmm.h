@@ -6,6 +6,9 @@
 #include <stdbool.h>
 #include <limine.h>
 #include "paging.h"
+#include "tlb.h"
+#include "vma.h"
+#include "../sys/spinlock.h"
 
 #define VMM_KERNEL_BASE 0xFFFFFFFF80000000
 #define VMM_HHDM_OFFSET 0xFFFF800000000000
@@ -13,20 +16,41 @@
 typedef struct {
     page_table_t* pml4;
     uint64_t hhdm_offset;
+    struct tlb_context tlb;     // PCID и CPU, где могли остаться записи TLB
+    struct vma_tree areas;      // области, которые #PF заполняет по требованию
+    spinlock_t area_lock;
 } vmm_space_t;
 
 void vmm_init(volatile struct limine_hhdm_response *hhdm_response);
 vmm_space_t* vmm_create_space(void);
 void vmm_destroy_space(vmm_space_t *space);
+vmm_space_t* vmm_clone_space(vmm_space_t *src);   // копия при записи
 void vmm_switch_space(vmm_space_t *space);
+vmm_space_t* vmm_current_space(void);
 
 bool vmm_map_page(vmm_space_t *space, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags);
+bool vmm_map_large_page(vmm_space_t *space, uint64_t virtual_addr, uint64_t physical_addr,
+                        uint64_t page_size, uint64_t flags);
 bool vmm_unmap_page(vmm_space_t *space, uint64_t virtual_addr);
+bool vmm_map_range(vmm_space_t *space, uint64_t virtual_addr, uint64_t physical_addr,
+                   uint64_t size, uint64_t flags);
+uint64_t vmm_unmap_range(vmm_space_t *space, uint64_t virtual_addr, uint64_t size);
 bool vmm_is_mapped(vmm_space_t *space, uint64_t virtual_addr);
 uint64_t vmm_get_physical(vmm_space_t *space, uint64_t virtual_addr);
+uint64_t vmm_get_page_size(vmm_space_t *space, uint64_t virtual_addr);
 
 bool vmm_map_kernel(vmm_space_t *space);
 
+// Области подкачки по требованию: страницы появляются при первом обращении
+bool vmm_map_anon(vmm_space_t *space, uint64_t virtual_addr, uint64_t size, uint64_t flags);
+bool vmm_map_file(vmm_space_t *space, uint64_t virtual_addr, uint64_t size, uint64_t flags,
+                  const struct vma_file *file, uint64_t offset);
+bool vmm_map_stack(vmm_space_t *space, uint64_t top, uint64_t max_size, uint64_t flags);
+bool vmm_map_device(vmm_space_t *space, uint64_t virtual_addr, uint64_t physical_addr,
+                    uint64_t size, uint64_t flags);
+bool vmm_unmap_area(vmm_space_t *space, uint64_t virtual_addr);   // область целиком
+bool vmm_handle_fault(uint64_t fault_address, uint64_t error_code);
+
 void vmm_dump_mappings(vmm_space_t *space);
 
 #endif
\ No newline at end of file
@@ -14,6 +14,8 @@
 #define ACPI_FADT_SIGNATURE "FACP"
 #define ACPI_MCFG_SIGNATURE "MCFG"
 #define ACPI_HPET_SIGNATURE "HPET"
+#define ACPI_SRAT_SIGNATURE "SRAT"
+#define ACPI_SLIT_SIGNATURE "SLIT"
 
 // RSDP Structure
 struct acpi_rsdp {
@@ -265,6 +267,63 @@ struct acpi_hpet {
     uint8_t page_protection;
 } __attribute__((packed));
 
+// SRAT (System Resource Affinity Table)
+struct acpi_srat {
+    struct acpi_sdt_header header;
+    uint32_t table_revision;
+    uint64_t reserved;
+} __attribute__((packed));
+
+#define SRAT_ENTRY_CPU_AFFINITY    0
+#define SRAT_ENTRY_MEMORY_AFFINITY 1
+#define SRAT_ENTRY_X2APIC_AFFINITY 2
+
+#define SRAT_FLAG_ENABLED      (1 << 0)
+#define SRAT_FLAG_HOTPLUGGABLE (1 << 1)
+
+struct srat_entry_header {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct srat_cpu_affinity {
+    struct srat_entry_header header;
+    uint8_t proximity_domain_low;
+    uint8_t apic_id;
+    uint32_t flags;
+    uint8_t sapic_eid;
+    uint8_t proximity_domain_high[3];
+    uint32_t clock_domain;
+} __attribute__((packed));
+
+struct srat_memory_affinity {
+    struct srat_entry_header header;
+    uint32_t proximity_domain;
+    uint16_t reserved;
+    uint64_t base_address;
+    uint64_t length;
+    uint32_t reserved2;
+    uint32_t flags;
+    uint64_t reserved3;
+} __attribute__((packed));
+
+struct srat_x2apic_affinity {
+    struct srat_entry_header header;
+    uint16_t reserved;
+    uint32_t proximity_domain;
+    uint32_t x2apic_id;
+    uint32_t flags;
+    uint32_t clock_domain;
+    uint32_t reserved2;
+} __attribute__((packed));
+
+// SLIT (System Locality Information Table)
+struct acpi_slit {
+    struct acpi_sdt_header header;
+    uint64_t locality_count;
+    uint8_t entries[];
+} __attribute__((packed));
+
 //ACPI 
 struct acpi_state {
     struct acpi_rsdp *rsdp;
@@ -274,6 +333,8 @@ struct acpi_state {
     struct acpi_fadt *fadt;
     struct acpi_mcfg *mcfg;
     struct acpi_hpet *hpet;
+    struct acpi_srat *srat;
+    struct acpi_slit *slit;
     bool use_xsdt;
     bool acpi_available;
     volatile struct limine_hhdm_response *hhdm_response; // Добавь эту строку
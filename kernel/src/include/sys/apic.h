@@ -34,6 +34,7 @@
 #define LAPIC_EOI_ACK 0x0
 #define LAPIC_SIV_ENABLE 0x100
 #define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_MASKED 0x10000
 
 #define IOAPIC_REDTBL_BASE 0x10
 
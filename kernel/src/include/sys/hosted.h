@@ -0,0 +1,26 @@
+#ifndef HOSTED_H
+#define HOSTED_H
+
+// Хостовая сборка (-DDEER_HOSTED): PMM, paging, куча и VMM работают внутри
+// обычного Linux-процесса. Привилегированные операции заменяются вызовами
+// симулятора из kernel/hosted/machine.c
+
+#ifdef DEER_HOSTED
+
+#include <stdint.h>
+
+extern __thread uint32_t hosted_cpu_id;
+
+uint64_t hosted_read_cr3(void);
+void hosted_write_cr3(uint64_t cr3);
+uint64_t hosted_read_cr2(void);
+
+// Листовые записи текущего PML4 отражаются в адресное пространство процесса
+void hosted_page_mapped(const void *pml4, uint64_t virtual_addr, uint64_t physical_addr, uint64_t size);
+void hosted_page_unmapped(const void *pml4, uint64_t virtual_addr, uint64_t size);
+
+__attribute__((noreturn)) void hosted_halt(void);
+
+#endif
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../memory/pmm.h"
+#include "smp.h"
+
+#define NUMA_MAX_RANGES      64
+#define NUMA_LOCAL_DISTANCE  10
+#define NUMA_REMOTE_DISTANCE 20
+
+struct numa_memory_range {
+    uint64_t base;
+    uint64_t length;
+    uint8_t node;
+};
+
+struct numa_state {
+    bool numa_available;
+    uint32_t node_count;
+    uint32_t proximity_domain[PMM_MAX_NODES];
+    uint8_t distance[PMM_MAX_NODES][PMM_MAX_NODES];
+    uint8_t fallback[PMM_MAX_NODES][PMM_MAX_NODES];
+    struct numa_memory_range ranges[NUMA_MAX_RANGES];
+    uint32_t range_count;
+    uint32_t cpu_apic_id[MAX_CPUS];
+    uint8_t cpu_node[MAX_CPUS];
+    uint32_t cpu_count;
+};
+
+void numa_init(void);
+uint32_t numa_get_node_count(void);
+uint8_t numa_node_of_apic(uint32_t apic_id);
+uint8_t numa_node_of_address(uint64_t phys);
+uint8_t numa_distance(uint8_t from, uint8_t to);
+void numa_dump_topology(void);
+
+extern struct numa_state numa_state;
+
+#endif // NUMA_H
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <limine.h>
+#include "hosted.h"
 
 #define CPU_STATE_UNUSED    0
 #define CPU_STATE_STARTING  1
@@ -11,6 +12,7 @@
 #define CPU_STATE_HALTED    3
 
 #define MAX_CPUS 256
+#define MSR_GS_BASE 0xC0000101
 
 struct cpu_info {
     uint32_t id;
@@ -19,6 +21,7 @@ struct cpu_info {
     volatile uint32_t state;
     uint64_t gs_base;
     bool is_bsp;
+    uint8_t numa_node;
 } __attribute__((packed));
 
 struct smp_state {
@@ -36,6 +39,7 @@ uint32_t smp_get_cpu_count(void);
 struct cpu_info *smp_get_current_cpu(void);
 struct cpu_info *smp_get_cpu_info(uint32_t cpu_id);
 bool smp_is_bsp(void);
+void smp_assign_numa_nodes(void);
 
 void smp_send_init(uint32_t lapic_id);
 void smp_send_startup(uint32_t lapic_id, uint8_t vector);
@@ -44,4 +48,16 @@ void smp_send_ipi(uint32_t lapic_id, uint8_t vector);
 
 extern struct smp_state smp_state;
 
+// Быстрое получение номера CPU: GS base указывает на struct cpu_info, id лежит по смещению 0
+static inline uint32_t smp_current_cpu_id(void) {
+#ifdef DEER_HOSTED
+    return hosted_cpu_id;
+#else
+    if (!smp_state.smp_initialized) return 0;
+    uint32_t id;
+    asm volatile("movl %%gs:0, %0" : "=r"(id));
+    return id;
+#endif
+}
+
 #endif // SMP_H
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef TICK_H
+#define TICK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TICK_VECTOR          32          // IRQ0, как и у периодического таймера
+#define TICK_HZ              1000
+#define TICK_PERIOD_NS       (1000000000ULL / TICK_HZ)
+#define TICK_CALIBRATE_MS    10
+#define TICK_LAPIC_DIVIDER   0x3         // делитель 16
+
+// Счётчики CPU. Опоздание - сколько нс прошло от срока до входа в обработчик
+struct tick_stats {
+    uint64_t interrupts;        // всего срабатываний таймера
+    uint64_t sched_ticks;       // из них тиков планировщика
+    uint64_t missed_ticks;      // тиков, пропущенных из-за опоздания
+    uint64_t early;             // сработал раньше срока (срок дальше предела счётчика)
+    uint64_t stops;             // тик планировщика остановлен (idle или одна задача)
+    uint64_t late_samples;
+    uint64_t late_total_ns;
+    uint64_t late_max_ns;
+};
+
+// NO_HZ: LAPIC в one-shot режиме заводится на ближайший срок - тик планировщика,
+// если в очереди CPU кто-то ждёт, или пробуждение из tick_sleep_ns.
+// Без HPET откалибровать таймер нечем, остаётся периодический режим TICK_HZ
+void tick_init(void);           // BSP: калибровка LAPIC и часов
+void tick_init_cpu(void);       // каждый CPU: свой таймер
+bool tick_nohz_active(void);
+
+uint64_t tick_now_ns(void);     // монотонные часы с момента калибровки
+void tick_sleep_ns(uint64_t ns);
+
+// Пересчитать ближайший срок этого CPU после изменения его очереди
+void tick_update(void);
+bool tick_sched_stopped(uint32_t cpu);
+void tick_interrupt(void);      // из lapic_timer_handler в режиме NO_HZ
+
+bool tick_get_stats(uint32_t cpu, struct tick_stats *stats);
+void tick_dump_stats(void);
+void tick_jitter_bench(uint32_t samples, uint64_t period_us);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct task;
+
+// Компоненты XCR0, которые ядро умеет сохранять
+#define FPU_XSTATE_X87      (1ULL << 0)
+#define FPU_XSTATE_SSE      (1ULL << 1)
+#define FPU_XSTATE_AVX      (1ULL << 2)
+#define FPU_XSTATE_AVX512   (7ULL << 5)    // opmask, ZMM_Hi256, Hi16_ZMM
+#define FPU_XSTATE_KNOWN    (FPU_XSTATE_X87 | FPU_XSTATE_SSE | FPU_XSTATE_AVX | FPU_XSTATE_AVX512)
+
+#define FPU_STATE_ALIGN     64
+#define FPU_CPU_NONE        0xFFFFFFFFU    // регистры задачи не загружены ни на одном CPU
+
+enum fpu_mode {
+    FPU_MODE_FXSAVE,
+    FPU_MODE_XSAVE,
+    FPU_MODE_XSAVEOPT,      // пропускает компоненты, не изменённые после XRSTOR
+    FPU_MODE_XSAVES,        // сжатый формат, плюс init/modified оптимизации
+};
+
+struct fpu_stats {
+    uint64_t traps;         // #NM: загрузка состояния задачи
+    uint64_t saves;         // сохранение при вытеснении
+    uint64_t reuses;        // задача вернулась на CPU, где её регистры ещё целы
+};
+
+// Регистры грузятся только по #NM (CR0.TS), сохраняются при вытеснении лишь
+// у задачи, трогавшей SIMD в этом кванте. Область в памяти после вытеснения
+// всегда актуальна, поэтому задачу можно переносить между CPU
+void fpu_init(void);        // BSP, до создания задач
+void fpu_init_cpu(void);    // каждый CPU: CR0/CR4, XCR0, IA32_XSS
+
+void *fpu_state_alloc(void);            // область в начальном состоянии
+void fpu_state_free(void *state);
+uint32_t fpu_state_size(void);
+
+// Из планировщика с выключенными прерываниями, до context_switch
+void fpu_switch(struct task *prev, struct task *next);
+
+bool fpu_get_stats(uint32_t cpu, struct fpu_stats *stats);
+void fpu_dump_stats(void);
+
+#endif
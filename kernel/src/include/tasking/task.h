@@ -2,27 +2,77 @@
 #define TASK_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define TASK_STATE_READY    0
 #define TASK_STATE_RUNNING  1
 #define TASK_STATE_BLOCKED  2
 #define TASK_STATE_EXITED   3
 
+// Приоритеты: чем меньше, тем выше. Idle-задача вне очередей
+#define TASK_PRIO_COUNT     32
+#define TASK_PRIO_DEFAULT   16
+#define TASK_DEFAULT_SLICE  10     // тиков LAPIC (~10 мс)
+
+#define TASK_FLAG_ALLOCATED (1U << 0)   // структура и стек от task_create, освобождаются при reap
+
+#define TASK_RESCHED_VECTOR   0xF1   // IPI: в очередь CPU добавлена задача
+#define TASK_BALANCE_INTERVAL 100    // тиков между периодическими балансировками
+#define TASK_BALANCE_BATCH    4      // задач за одну балансировку
+
+#define TASK_STACK_SIZE       0x4000
+#define TASK_BENCH_STACK_SIZE 0x4000
+
+// Регистры задачи лежат на её стеке (см. context_switch.asm), здесь - только rsp
 struct task {
-    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
-    uint64_t rdi, rsi, rbp, rbx, rdx, rcx, rax;
-    uint64_t rip, cs, rflags, rsp, ss;
-    struct task *next;
+    uint64_t rsp;
+    struct task *next;          // очередь готовых или список завершённых
     uint32_t id;
     int state;
     void *stack_top;
+    void *stack_base;
+    uint64_t switches;
+    uint32_t flags;
+    uint8_t priority;
+    uint32_t timeslice;
+    uint32_t slice_left;
+    uint32_t cpu;               // CPU, в чьей очереди задача или на котором выполняется
+    void *fpu_state;            // x87/SSE/AVX, грузится лениво (см. fpu.h)
+    uint32_t fpu_cpu;           // CPU, где регистры задачи загружены последними
 };
 
-extern struct task *current_task;
+// Нагрузка CPU; load_avg - скользящее среднее nr_running, 1024 = одна задача
+struct task_cpu_stats {
+    uint32_t nr_running;        // в очереди плюс выполняемая (кроме idle)
+    uint32_t load_avg;
+    uint64_t switches;
+    uint64_t busy_ticks;
+    uint64_t idle_ticks;
+    uint64_t steals;            // взято простаивающим CPU из чужой очереди
+    uint64_t pulls;             // перенесено периодической балансировкой
+    uint64_t resched_ipis;      // отправлено другим CPU ради новой задачи
+};
 
 void task_init(struct task *t, uint64_t entry, void *stack_top, uint32_t id);
-void task_add(struct task *t); // <-- Эта строка была добавлена!
+struct task *task_create(void (*entry)(void *arg), void *arg, uint8_t priority);
+void task_add(struct task *t);
+void task_set_priority(struct task *t, uint8_t priority);
+void task_set_timeslice(struct task *t, uint32_t ticks);
 void tasking_init(void);
+__attribute__((noreturn)) void task_start(void);   // контекст загрузки CPU становится его idle
+struct task *task_current(void);
+void task_yield(void);
+__attribute__((noreturn)) void task_exit(void);
+
+// Таймер только просит переключения, само переключение - на выходе из IRQ после EOI
 void task_scheduler_tick(void);
+void task_preempt(void);
+bool task_tick_needed(void);     // NO_HZ: в очереди этого CPU ждут задачи
+void task_finish_switch(void);   // первым делом в задаче после context_switch
+
+bool task_get_cpu_stats(uint32_t cpu, struct task_cpu_stats *stats);
+void task_dump_stats(void);
+
+void task_switch_bench(uint32_t rounds);
 
-#endif
\ No newline at end of file
+#endif
@@ -60,6 +60,9 @@ extern void isr_stub_45(void);
 extern void isr_stub_46(void);
 extern void isr_stub_47(void);
 
+extern void isr_stub_240(void);
+extern void isr_stub_241(void);
+
 static isr_handler_t isr_handlers[256] = {0};
 
 // Декларация обработчика из isr.c
@@ -134,6 +137,11 @@ void idt_init(void) {
     idt_set_entry(45, (uint64_t)isr_stub_45, 0x08, IDT_PRESENT | IDT_RING0 | IDT_TYPE_INT);
     idt_set_entry(46, (uint64_t)isr_stub_46, 0x08, IDT_PRESENT | IDT_RING0 | IDT_TYPE_INT);
     idt_set_entry(47, (uint64_t)isr_stub_47, 0x08, IDT_PRESENT | IDT_RING0 | IDT_TYPE_INT);
+
+    // IPI: TLB shootdown
+    idt_set_entry(240, (uint64_t)isr_stub_240, 0x08, IDT_PRESENT | IDT_RING0 | IDT_TYPE_INT);
+    // IPI: перепланирование
+    idt_set_entry(241, (uint64_t)isr_stub_241, 0x08, IDT_PRESENT | IDT_RING0 | IDT_TYPE_INT);
     // Настраиваем указатель IDT
     idtp.limit = sizeof(idt) - 1;
     idtp.base = (uint64_t)&idt;
@@ -31,6 +31,10 @@ void irq_handler(struct registers *regs) {
         // Иначе используем PIC EOI
         pic_send_eoi(irq_num);
     }
+
+    // Переключаемся только после EOI, иначе следующий тик не придёт,
+    // пока эта задача снова не получит CPU
+    task_preempt();
 }
 
 void irq_init(void) {
@@ -72,6 +72,10 @@ ISR_NOERRCODE 45
 ISR_NOERRCODE 46
 ISR_NOERRCODE 47
 
+; Межпроцессорные прерывания
+ISR_NOERRCODE 240
+ISR_NOERRCODE 241
+
 ; Общая точка входа для всех прерываний
 isr_common_stub:
     ; Сохраняем все общие регистры (callee-saved + остальные для консистентности)
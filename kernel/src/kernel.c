@@ -22,9 +22,15 @@
 #include "include/memory/paging.h"
 #include "include/memory/vmm.h"
 #include "include/memory/heap.h"
+#include "include/memory/slab.h"
+#include "include/memory/vmalloc.h"
+#include "include/memory/tlb.h"
+#include "include/memory/ioremap.h"
 #include "include/sys/acpi.h"
 #include "include/sys/apic.h"
 #include "include/sys/smp.h"
+#include "include/sys/numa.h"
+#include "include/sys/tick.h"
 #include "include/tasking/task.h"
 
 #define STACK_SIZE 0x2000
@@ -100,9 +106,27 @@ void initialize_memory_subsystems(void) {
     heap_init();
     serial_puts("[DEER] Heap initialized\n");
 
+    serial_puts("[DEER] Initializing Slab Allocator...\n");
+    slab_init();
+    serial_puts("[DEER] Slab initialized\n");
+
     serial_puts("[DEER] Initializing Virtual Memory Manager...\n");
     vmm_init(hhdm_response);
     serial_puts("[DEER] VMM initialized\n");
+
+    serial_puts("[DEER] Initializing vmalloc...\n");
+    vmalloc_init();
+    serial_puts("[DEER] vmalloc initialized\n");
+
+    // Вывод рисует по пикселю: WC собирает записи в пакеты вместо UC-обращений
+    if (framebuffer_request.response) {
+        for (uint64_t i = 0; i < framebuffer_request.response->framebuffer_count; i++) {
+            struct limine_framebuffer *fb = framebuffer_request.response->framebuffers[i];
+            void *wc = ioremap((uint64_t)fb->address - hhdm_response->offset,
+                               fb->pitch * fb->height, IOREMAP_WC);
+            if (wc) fb->address = wc;
+        }
+    }
 }
 
 void initialize_subsystems(void) {
@@ -121,6 +145,8 @@ void initialize_subsystems(void) {
     idt_init();
     serial_puts("[DEER] IDT initialized\n");
 
+    tlb_init();
+
     serial_puts("[DEER] Initializing ACPI...\n");
     acpi_init(hhdm_response); 
     serial_puts("[DEER] ACPI initialized\n");
@@ -133,13 +159,17 @@ void initialize_subsystems(void) {
     smp_init(mp_request.response);
     serial_puts("[DEER] SMP initialized\n");
 
+    serial_puts("[DEER] Initializing NUMA...\n");
+    numa_init();
+    serial_puts("[DEER] NUMA initialized\n");
+
     serial_puts("[DEER] Initializing IRQ...\n");
     irq_init();
     serial_puts("[DEER] IRQ initialized\n");
 
     if (apic_state.apic_available && apic_state.ioapic_available) {
         serial_puts("[DEER] Initializing LAPIC timer...\n");
-        lapic_timer_init(32, 1000); // IRQ0, 1000Hz
+        tick_init(); // IRQ0: one-shot NO_HZ или периодический 1000Hz
         serial_puts("[DEER] LAPIC timer initialized\n");
     } else {
         serial_puts("[DEER] Initializing PIT...\n");
@@ -224,7 +254,8 @@ void display_system_info(struct limine_framebuffer *fb) {
 }
 
 // task 1 func
-__attribute__((noreturn)) void task1_func(void) {
+__attribute__((noreturn)) void task1_func(void *arg) {
+    (void)arg;
     volatile int i = 0;
     while (1) {
         if (i % 10000000 == 0) {
@@ -234,7 +265,8 @@ __attribute__((noreturn)) void task1_func(void) {
     }
 }
 // task 2 func for test
-__attribute__((noreturn)) void task2_func(void) {
+__attribute__((noreturn)) void task2_func(void *arg) {
+    (void)arg;
     volatile int j = 0;
     while (1) {
         if (j % 10000000 == 0) {
@@ -248,39 +280,25 @@ void setup_and_start_tasks(void) {
     printf("[TASK] Setting up test tasks...\n"); // выводим сообщение о старте
 
     tasking_init();
+    task_switch_bench(100000);
+    tick_jitter_bench(200, 500);
 
-#define TASK_STACK_SIZE 0x4000
-    void *raw_stack1 = kmalloc(TASK_STACK_SIZE);
-    void *raw_stack2 = kmalloc(TASK_STACK_SIZE);
-
-    // Выравниваем стек по 16-байтной границе (требование ABI x86-64)
-    uintptr_t stack1_top = (uintptr_t)raw_stack1 + TASK_STACK_SIZE;
-    uintptr_t stack2_top = (uintptr_t)raw_stack2 + TASK_STACK_SIZE;
-    stack1_top &= ~0xF;
-    stack2_top &= ~0xF;
+    // AP входят в планировщик сразу после старта и забирают задачи из общей работы
+    smp_start_aps();
 
-    void *stack1 = (void*)stack1_top;
-    void *stack2 = (void*)stack2_top;
-
-    static struct task task1, task2;
-
-    task_init(&task1, (uint64_t)task1_func, (char*)stack1 + TASK_STACK_SIZE, 1);
-    task_init(&task2, (uint64_t)task2_func, (char*)stack2 + TASK_STACK_SIZE, 2);
-
-    extern struct task *current_task;
-    current_task = &task1;
-    current_task->state = TASK_STATE_RUNNING;
+    struct task *task1 = task_create(task1_func, NULL, TASK_PRIO_DEFAULT);
+    struct task *task2 = task_create(task2_func, NULL, TASK_PRIO_DEFAULT);
+    if (!task1 || !task2) {
+        serial_puts("[TASK] ERROR: Failed to create test tasks\n");
+        return;
+    }
 
-    task_add(&task1);
-    task_add(&task2);
+    task_add(task1);
+    task_add(task2);
 
     serial_puts("[TASK] Tasks created. Switching to first task...\n");
 
-    extern void switch_to_task(struct task *t);
-    switch_to_task(current_task);
-
-    // Эта строка никогда не выполнится
-    printf("[TASK] ERROR: Returned from switch_to_task!\n");
+    task_start();
 }
 
 void kernel_main(void) {
@@ -322,6 +340,9 @@ void kernel_main(void) {
     // 7. Главный цикл
     serial_puts("[DEER] Entering idle loop...\n");
     while (1) {
-        asm volatile("hlt");
+        // Пока есть работа по обнулению страниц - не спим
+        if (!pmm_zero_pool_refill(PMM_ZERO_POOL_BATCH)) {
+            asm volatile("hlt");
+        }
     }
 }
\ No newline at end of file
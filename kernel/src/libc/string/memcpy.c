@@ -2,12 +2,19 @@
 #include <stdint.h>
 
 void *memcpy(void *restrict dest, const void *restrict src, size_t n) {
-    uint8_t *restrict pdest = (uint8_t *restrict)dest;
-    const uint8_t *restrict psrc = (const uint8_t *restrict)src;
+    void *ret = dest;
 
-    for (size_t i = 0; i < n; i++) {
-        pdest[i] = psrc[i];
-    }
+    // Основной объём копируем по 8 байт, хвост - побайтно; оба через rep movs
+    size_t qwords = n >> 3;
+    size_t bytes = n & 7;
+    asm volatile("rep movsq"
+                 : "+D"(dest), "+S"(src), "+c"(qwords)
+                 :
+                 : "memory");
+    asm volatile("rep movsb"
+                 : "+D"(dest), "+S"(src), "+c"(bytes)
+                 :
+                 : "memory");
 
-    return dest;
-}
\ No newline at end of file
+    return ret;
+}
@@ -0,0 +1,173 @@
+#include "include/memory/alloc_trace.h"
+#include "include/sys/smp.h"
+#include "include/drivers/serial.h"
+#include "libc/string.h"
+
+#ifdef HEAP_TRACE
+
+// Кольцо пишет в основном свой CPU; слот резервируется атомарно,
+// поэтому прерывание посреди записи не портит чужую запись
+struct alloc_trace_ring {
+    volatile uint64_t head;
+    struct alloc_trace_record records[ALLOC_TRACE_RING_SIZE];
+} __attribute__((aligned(64)));
+
+static struct alloc_trace_ring rings[ALLOC_TRACE_CPUS];
+static struct alloc_trace_site sites[ALLOC_TRACE_SITES];
+static volatile uint64_t sites_dropped = 0;
+
+static void site_account(uint64_t rip, size_t size) {
+    uint32_t slot = (uint32_t)((rip * 0x9E3779B97F4A7C15ULL) >> 56) & (ALLOC_TRACE_SITES - 1);
+
+    for (uint32_t probe = 0; probe < ALLOC_TRACE_SITES; probe++) {
+        struct alloc_trace_site *site = &sites[(slot + probe) & (ALLOC_TRACE_SITES - 1)];
+        uint64_t current = __atomic_load_n(&site->rip, __ATOMIC_RELAXED);
+
+        if (current == 0) {
+            uint64_t expected = 0;
+            if (__atomic_compare_exchange_n(&site->rip, &expected, rip, false,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                current = rip;
+            } else {
+                current = expected;
+            }
+        }
+        if (current == rip) {
+            __atomic_fetch_add(&site->allocs, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&site->bytes, size, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_fetch_add(&sites_dropped, 1, __ATOMIC_RELAXED);
+}
+
+void alloc_trace_record(uint8_t type, uint64_t rip, const void *ptr, size_t size) {
+    uint32_t cpu = smp_current_cpu_id();
+    struct alloc_trace_ring *ring = &rings[cpu % ALLOC_TRACE_CPUS];
+
+    uint64_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    struct alloc_trace_record *record = &ring->records[index & (ALLOC_TRACE_RING_SIZE - 1)];
+    record->tsc = alloc_trace_tsc();
+    record->rip = rip;
+    record->ptr = (uint64_t)ptr;
+    record->size = (uint32_t)size;
+    record->type = type;
+    record->cpu = (uint8_t)cpu;
+
+    if (type == ALLOC_TRACE_ALLOC || type == ALLOC_TRACE_REALLOC) {
+        site_account(rip, size);
+    }
+}
+
+bool alloc_trace_enabled(void) {
+    return true;
+}
+
+static const char *type_name(uint8_t type) {
+    switch (type) {
+        case ALLOC_TRACE_ALLOC: return "alloc  ";
+        case ALLOC_TRACE_FREE: return "free   ";
+        case ALLOC_TRACE_REALLOC: return "realloc";
+        case ALLOC_TRACE_FAULT: return "fault  ";
+        default: return "?      ";
+    }
+}
+
+void alloc_trace_dump(void) {
+    char buf[32];
+    serial_puts("[TRACE] Allocation trace (tsc type rip ptr size):\n");
+
+    for (uint32_t cpu = 0; cpu < ALLOC_TRACE_CPUS; cpu++) {
+        struct alloc_trace_ring *ring = &rings[cpu];
+        uint64_t head = ring->head;
+        if (!head) continue;
+
+        uint64_t first = head > ALLOC_TRACE_RING_SIZE ? head - ALLOC_TRACE_RING_SIZE : 0;
+        serial_puts("  CPU ");
+        serial_puts(itoa(cpu, buf, 10));
+        serial_puts(": ");
+        serial_puts(itoa(head, buf, 10));
+        serial_puts(" events, ");
+        serial_puts(itoa(head - first, buf, 10));
+        serial_puts(" kept\n");
+
+        for (uint64_t i = first; i < head; i++) {
+            struct alloc_trace_record *record = &ring->records[i & (ALLOC_TRACE_RING_SIZE - 1)];
+            serial_puts("    ");
+            serial_puts(itoa(record->tsc, buf, 10));
+            serial_puts(" ");
+            serial_puts(type_name(record->type));
+            serial_puts(" 0x");
+            serial_puts(itoa(record->rip, buf, 16));
+            serial_puts(" 0x");
+            serial_puts(itoa(record->ptr, buf, 16));
+            serial_puts(" ");
+            serial_puts(itoa(record->size, buf, 10));
+            serial_puts("\n");
+        }
+    }
+}
+
+// Сводка по местам вызова: ALLOC_TRACE_TOP самых "тяжёлых" по байтам
+void alloc_trace_dump_sites(void) {
+    char buf[32];
+    bool shown[ALLOC_TRACE_SITES];
+    memset(shown, 0, sizeof(shown));
+
+    serial_puts("[TRACE] Top allocation sites (rip allocs bytes):\n");
+    for (uint32_t n = 0; n < ALLOC_TRACE_TOP; n++) {
+        int best = -1;
+        for (uint32_t i = 0; i < ALLOC_TRACE_SITES; i++) {
+            if (shown[i] || !sites[i].rip) continue;
+            if (best < 0 || sites[i].bytes > sites[best].bytes) best = (int)i;
+        }
+        if (best < 0) break;
+        shown[best] = true;
+
+        serial_puts("  0x");
+        serial_puts(itoa(sites[best].rip, buf, 16));
+        serial_puts(" ");
+        serial_puts(itoa(sites[best].allocs, buf, 10));
+        serial_puts(" ");
+        serial_puts(itoa(sites[best].bytes, buf, 10));
+        serial_puts("\n");
+    }
+
+    if (sites_dropped) {
+        serial_puts("  (site table full, ");
+        serial_puts(itoa(sites_dropped, buf, 10));
+        serial_puts(" allocations unaccounted)\n");
+    }
+}
+
+void alloc_trace_reset(void) {
+    memset(rings, 0, sizeof(rings));
+    memset(sites, 0, sizeof(sites));
+    sites_dropped = 0;
+}
+
+#else
+
+void alloc_trace_record(uint8_t type, uint64_t rip, const void *ptr, size_t size) {
+    (void)type;
+    (void)rip;
+    (void)ptr;
+    (void)size;
+}
+
+bool alloc_trace_enabled(void) {
+    return false;
+}
+
+void alloc_trace_dump(void) {
+    serial_puts("[TRACE] Allocation tracing disabled (build with --heap-trace)\n");
+}
+
+void alloc_trace_dump_sites(void) {
+    alloc_trace_dump();
+}
+
+void alloc_trace_reset(void) {
+}
+
+#endif
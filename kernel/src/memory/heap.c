@@ -1,156 +1,507 @@
 #include "include/memory/heap.h"
 #include "include/memory/paging.h"
 #include "include/memory/pmm.h"
+#include "include/memory/slab.h"
+#include "include/memory/alloc_trace.h"
+#include "include/sys/smp.h"
 #include "include/drivers/serial.h"
 #include "libc/string.h"
 #include "libc/stdio.h"
 
-static heap_t kernel_heap = {0};
+static heap_t arenas[HEAP_MAX_ARENAS];
 
-void heap_init(void) {
-    serial_puts("[HEAP] Initializing...\n");
-    
-    size_t initial_pages = HEAP_INITIAL_SIZE / PAGE_SIZE_4K;
-    
-    for (size_t i = 0; i < initial_pages; i++) {
-        uint64_t physical_page = pmm_alloc_page();
-        if (!physical_page) {
+static void insert_free_block(heap_t* heap, heap_block_t* block);
+
+// Отображает [start, start + size) кусками до границы 2 MiB: каждый кусок -
+// один непрерывный блок PMM и один вызов paging_map_range
+static bool heap_map_region(uint64_t start, uint64_t size) {
+    uint64_t flags = PAGING_PRESENT | PAGING_WRITABLE;
+
+    for (uint64_t offset = 0; offset < size; ) {
+        uint64_t virtual_addr = start + offset;
+        uint64_t chunk = PAGE_SIZE_2M - (virtual_addr & (PAGE_SIZE_2M - 1));
+        if (chunk > size - offset) chunk = size - offset;
+
+        uint64_t physical = chunk == PAGE_SIZE_2M
+            ? pmm_alloc_pages_aligned(PAGE_SIZE_2M / PAGE_SIZE_4K, PAGE_SIZE_2M)
+            : pmm_alloc_pages(chunk / PAGE_SIZE_4K);
+        if (!physical) {
+            // Непрерывного блока нет - добираем по одной странице
+            chunk = PAGE_SIZE_4K;
+            physical = pmm_alloc_page();
+        }
+        if (!physical) {
             serial_puts("[HEAP] ERROR: Failed to allocate physical pages!\n");
-            return;
+            return false;
         }
-        
-        uint64_t virtual_addr = HEAP_START + (i * PAGE_SIZE_4K);
-        if (!paging_map_page(virtual_addr, physical_page, 
-                           PAGING_PRESENT | PAGING_WRITABLE)) {
+
+        if (!paging_map_range(virtual_addr, physical, chunk, flags)) {
             serial_puts("[HEAP] ERROR: Failed to map heap page!\n");
-            pmm_free_page(physical_page);
-            return;
+            pmm_free_pages(physical, chunk / PAGE_SIZE_4K);
+            return false;
         }
+        offset += chunk;
     }
-    
-    kernel_heap.start = (void*)HEAP_START;
-    kernel_heap.end = (void*)(HEAP_START + HEAP_INITIAL_SIZE);
-    kernel_heap.total_size = HEAP_INITIAL_SIZE;
-    kernel_heap.used_size = 0;
-    kernel_heap.block_count = 1;
-    
-    heap_block_t* first_block = (heap_block_t*)HEAP_START;
+    return true;
+}
+
+// Вызывается под блокировкой арены
+static bool arena_init(heap_t* heap) {
+    uint64_t start = HEAP_START + (uint64_t)heap->id * HEAP_ARENA_SIZE;
+    if (!heap_map_region(start, HEAP_INITIAL_SIZE)) return false;
+
+    heap->start = (void*)start;
+    heap->end = (void*)(start + HEAP_INITIAL_SIZE);
+    heap->total_size = HEAP_INITIAL_SIZE;
+    heap->used_size = 0;
+    heap->block_count = 1;
+
+    heap_block_t* first_block = (heap_block_t*)start;
     first_block->size = HEAP_INITIAL_SIZE - sizeof(heap_block_t);
     first_block->used = false;
+    first_block->arena = heap->id;
     first_block->next = NULL;
     first_block->prev = NULL;
-    
-    kernel_heap.first_block = first_block;
-    
+
+    heap->first_block = first_block;
+    heap->last_block = first_block;
+    insert_free_block(heap, first_block);
+    heap->initialized = true;
+    return true;
+}
+
+void heap_init(void) {
+    serial_puts("[HEAP] Initializing...\n");
+
+    for (uint32_t i = 0; i < HEAP_MAX_ARENAS; i++) {
+        memset(&arenas[i], 0, sizeof(heap_t));
+        arenas[i].id = (uint8_t)i;
+    }
+
+    // Арена BSP создаётся сразу, остальные - при первом обращении своего CPU
+    if (!arena_init(&arenas[0])) {
+        return;
+    }
+
     serial_puts("[HEAP] Ready at 0x");
     char buf[32];
     serial_puts(itoa(HEAP_START, buf, 16));
     serial_puts(" (");
     serial_puts(itoa(HEAP_INITIAL_SIZE / 1024, buf, 10));
-    serial_puts(" KB)\n");
+    serial_puts(" KB, ");
+    serial_puts(itoa(HEAP_MAX_ARENAS, buf, 10));
+    serial_puts(" arenas)\n");
 }
 
-static heap_block_t* find_free_block(size_t size) {
-    heap_block_t* current = kernel_heap.first_block;
-    heap_block_t* best = NULL;
-    
-    while (current != NULL) {
-        if (!current->used && current->size >= size) {
-            if (!best || current->size < best->size) {
-                best = current;
-            }
+// В свободном блоке ссылки списка лежат в начале полезной нагрузки
+typedef struct {
+    heap_block_t* next_free;
+    heap_block_t* prev_free;
+} heap_free_links_t;
+
+static inline heap_free_links_t* free_links(heap_block_t* block) {
+    return (heap_free_links_t*)((uint8_t*)block + sizeof(heap_block_t));
+}
+
+static inline uint32_t fls_size(size_t size) {
+    return 63 - __builtin_clzll(size);
+}
+
+static void mapping_insert(size_t size, uint32_t* fl, uint32_t* sl) {
+    if (size < HEAP_SMALL_BLOCK) {
+        *fl = 0;
+        *sl = size / (HEAP_SMALL_BLOCK / HEAP_SL_COUNT);
+    } else {
+        uint32_t f = fls_size(size);
+        *sl = (size >> (f - HEAP_SL_LOG2)) ^ HEAP_SL_COUNT;
+        *fl = f - (HEAP_FL_SHIFT - 1);
+    }
+}
+
+// Округляем вверх, чтобы любой блок из найденного списка подходил без проверки
+static void mapping_search(size_t size, uint32_t* fl, uint32_t* sl) {
+    if (size >= HEAP_SMALL_BLOCK) {
+        size += (1ULL << (fls_size(size) - HEAP_SL_LOG2)) - 1;
+    }
+    mapping_insert(size, fl, sl);
+}
+
+static void insert_free_block(heap_t* heap, heap_block_t* block) {
+    uint32_t fl, sl;
+    mapping_insert(block->size, &fl, &sl);
+
+    heap_block_t* head = heap->free_lists[fl][sl];
+    free_links(block)->next_free = head;
+    free_links(block)->prev_free = NULL;
+    if (head) free_links(head)->prev_free = block;
+    heap->free_lists[fl][sl] = block;
+
+    heap->fl_bitmap |= 1U << fl;
+    heap->sl_bitmap[fl] |= 1U << sl;
+}
+
+static void remove_free_block(heap_t* heap, heap_block_t* block) {
+    uint32_t fl, sl;
+    mapping_insert(block->size, &fl, &sl);
+
+    heap_block_t* next = free_links(block)->next_free;
+    heap_block_t* prev = free_links(block)->prev_free;
+    if (next) free_links(next)->prev_free = prev;
+    if (prev) {
+        free_links(prev)->next_free = next;
+    } else {
+        heap->free_lists[fl][sl] = next;
+        if (!next) {
+            heap->sl_bitmap[fl] &= ~(1U << sl);
+            if (!heap->sl_bitmap[fl]) heap->fl_bitmap &= ~(1U << fl);
         }
-        current = current->next;
     }
-    return best;
 }
 
-void* kmalloc(size_t size) {
-    if (size == 0) return NULL;
-    
-    size = (size + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
-    if (size < sizeof(heap_block_t)) {
-        size = sizeof(heap_block_t);
+static heap_block_t* find_free_block(heap_t* heap, size_t size) {
+    uint32_t fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= HEAP_FL_COUNT) return NULL;
+
+    uint32_t sl_map = heap->sl_bitmap[fl] & (~0U << sl);
+    if (!sl_map) {
+        uint32_t fl_map = fl + 1 < 32 ? heap->fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (!fl_map) return NULL;
+        fl = __builtin_ctz(fl_map);
+        sl_map = heap->sl_bitmap[fl];
     }
-    
-    heap_block_t* block = find_free_block(size);
-    if (!block) {
-        serial_puts("[HEAP] No free block found for size ");
-        char buf[32];
-        serial_puts(itoa(size, buf, 10));
-        serial_puts("\n");
-        return NULL;
+    sl = __builtin_ctz(sl_map);
+    return heap->free_lists[fl][sl];
+}
+
+static inline bool heap_contains(const void* ptr) {
+    return (uint64_t)ptr >= HEAP_START && (uint64_t)ptr < HEAP_START + HEAP_MAX_SIZE;
+}
+
+static inline heap_t* current_arena(void) {
+    return &arenas[smp_current_cpu_id() % HEAP_MAX_ARENAS];
+}
+
+static uint64_t arena_lock(heap_t* heap) {
+    uint64_t flags = irq_save();
+    if (!spin_trylock(&heap->lock)) {
+        spin_lock(&heap->lock);
+        heap->stats.lock_contended++;
     }
-    
-    if (block->size >= size + sizeof(heap_block_t) + HEAP_ALIGNMENT) {
-        heap_block_t* new_block = (heap_block_t*)((uint8_t*)block + sizeof(heap_block_t) + size);
-        new_block->size = block->size - size - sizeof(heap_block_t);
-        new_block->used = false;
-        new_block->next = block->next;
-        new_block->prev = block;
-        
-        if (block->next) {
-            block->next->prev = new_block;
-        }
-        block->next = new_block;
-        block->size = size;
-        
-        kernel_heap.block_count++;
+    return flags;
+}
+
+static inline void arena_unlock(heap_t* heap, uint64_t flags) {
+    spin_unlock_irqrestore(&heap->lock, flags);
+}
+
+// Отрезает от block всё сверх size в свободный блок; возвращает отрезанное число байт
+static size_t split_block(heap_t* heap, heap_block_t* block, size_t size) {
+    if (block->size < size + sizeof(heap_block_t) + HEAP_MIN_BLOCK) return 0;
+
+    size_t released = block->size - size;
+    heap_block_t* new_block = (heap_block_t*)((uint8_t*)block + sizeof(heap_block_t) + size);
+    new_block->size = released - sizeof(heap_block_t);
+    new_block->used = false;
+    new_block->arena = heap->id;
+    new_block->next = block->next;
+    new_block->prev = block;
+
+    if (block->next) {
+        block->next->prev = new_block;
+    }
+    block->next = new_block;
+    block->size = size;
+    if (heap->last_block == block) heap->last_block = new_block;
+    heap->block_count++;
+
+    // При сжатии на месте за хвостом может оказаться свободный сосед
+    heap_block_t* next = new_block->next;
+    if (next && !next->used) {
+        remove_free_block(heap, next);
+        new_block->size += next->size + sizeof(heap_block_t);
+        new_block->next = next->next;
+        if (next->next) next->next->prev = new_block;
+        if (heap->last_block == next) heap->last_block = new_block;
+        heap->block_count--;
     }
-    
+
+    insert_free_block(heap, new_block);
+    return released;
+}
+
+static void* arena_alloc(heap_t* heap, size_t size) {
+    heap_block_t* block = find_free_block(heap, size);
+    if (!block) return NULL;
+    remove_free_block(heap, block);
+    split_block(heap, block, size);
+
     block->used = true;
-    kernel_heap.used_size += block->size; 
-    
-    serial_puts("[HEAP] Allocated ");
-    char buf[32];
-    serial_puts(itoa(size, buf, 10));
-    serial_puts(" bytes, total used: ");
-    serial_puts(itoa(kernel_heap.used_size, buf, 10));
-    serial_puts(" bytes\n");
-    
+    heap->used_size += block->size;
+    heap->stats.allocs++;
+
     return (void*)((uint8_t*)block + sizeof(heap_block_t));
 }
 
-void kfree(void* ptr) {
-    if (!ptr) return;
-    
-    heap_block_t* block = (heap_block_t*)((uint8_t*)ptr - sizeof(heap_block_t));
-    if (!block->used) {
-        serial_puts("[HEAP] Double free detected at 0x");
-        char buf[32];
-        serial_puts(itoa((uint64_t)ptr, buf, 16));
-        serial_puts("\n");
-        return;
+// Отрезает свободный хвост арены сверх начального размера
+static void arena_shrink_tail(heap_t* heap, heap_block_t* block) {
+    uint64_t start = (uint64_t)heap->start;
+    uint64_t end = (uint64_t)heap->end;
+    uint64_t payload = (uint64_t)block + sizeof(heap_block_t);
+
+    uint64_t new_end = (payload + HEAP_MIN_BLOCK + PAGE_SIZE_4K - 1) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    if (new_end < start + HEAP_INITIAL_SIZE) new_end = start + HEAP_INITIAL_SIZE;
+    if (new_end >= end) return;
+
+    block->size = new_end - payload;
+    heap->end = (void*)new_end;
+    heap->total_size = new_end - start;
+    heap->stats.pages_returned += paging_unmap_range(new_end, end - new_end);
+}
+
+// Страницы внутри большого свободного блока отдаём в PMM; при повторном
+// использовании их снова подставит обработчик page fault
+static void arena_trim_block(heap_t* heap, heap_block_t* block) {
+    if (block == heap->last_block) {
+        arena_shrink_tail(heap, block);
+    }
+    if (block->size < HEAP_TRIM_THRESHOLD) return;
+
+    // Заголовок, ссылки свободного списка и заголовок следующего блока остаются на месте
+    uint64_t first = ((uint64_t)block + sizeof(heap_block_t) + sizeof(heap_free_links_t) + PAGE_SIZE_4K - 1)
+                   & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    uint64_t last = ((uint64_t)block + sizeof(heap_block_t) + block->size) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    if (first < last) {
+        heap->stats.pages_returned += paging_unmap_range(first, last - first);
     }
-    
+}
+
+static void arena_free(heap_t* heap, heap_block_t* block) {
     block->used = false;
-    kernel_heap.used_size -= block->size;
-    
-    serial_puts("[HEAP] Freed ");
-    char buf[32];
-    serial_puts(itoa(block->size, buf, 10));
-    serial_puts(" bytes, total used: ");
-    serial_puts(itoa(kernel_heap.used_size, buf, 10));
-    serial_puts(" bytes\n");
-    
+    heap->used_size -= block->size;
+    heap->stats.frees++;
+
     if (block->prev && !block->prev->used) {
+        remove_free_block(heap, block->prev);
         block->prev->size += block->size + sizeof(heap_block_t);
         block->prev->next = block->next;
         if (block->next) {
             block->next->prev = block->prev;
         }
-        kernel_heap.block_count--;
+        if (heap->last_block == block) heap->last_block = block->prev;
+        heap->block_count--;
         block = block->prev;
     }
-    
+
     if (block->next && !block->next->used) {
+        remove_free_block(heap, block->next);
+        if (heap->last_block == block->next) heap->last_block = block;
         block->size += block->next->size + sizeof(heap_block_t);
         block->next = block->next->next;
         if (block->next) {
             block->next->prev = block;
         }
-        kernel_heap.block_count--;
+        heap->block_count--;
+    }
+
+    if (block->size >= HEAP_TRIM_THRESHOLD || block == heap->last_block) {
+        arena_trim_block(heap, block);
     }
+    insert_free_block(heap, block);
+}
+
+// Расширяет арену хотя бы на size байт полезной нагрузки
+static bool arena_grow(heap_t* heap, size_t size) {
+    uint64_t limit = HEAP_START + ((uint64_t)heap->id + 1) * HEAP_ARENA_SIZE;
+    uint64_t end = (uint64_t)heap->end;
+
+    uint64_t needed = size + sizeof(heap_block_t);
+    uint64_t grow = (needed + HEAP_GROW_CHUNK - 1) & ~(uint64_t)(HEAP_GROW_CHUNK - 1);
+    if (end + grow > limit) {
+        grow = (needed + PAGE_SIZE_4K - 1) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+        if (end + grow > limit) return false;
+    }
+
+    if (!heap_map_region(end, grow)) {
+        paging_unmap_range(end, grow);
+        return false;
+    }
+
+    heap_block_t* last = heap->last_block;
+    heap_block_t* block;
+    if (last && !last->used) {
+        // Хвостовой свободный блок просто удлиняется
+        remove_free_block(heap, last);
+        last->size += grow;
+        block = last;
+    } else {
+        block = (heap_block_t*)end;
+        block->size = grow - sizeof(heap_block_t);
+        block->used = false;
+        block->arena = heap->id;
+        block->next = NULL;
+        block->prev = last;
+        if (last) last->next = block;
+        heap->last_block = block;
+        heap->block_count++;
+    }
+
+    heap->end = (void*)(end + grow);
+    heap->total_size += grow;
+    heap->stats.grows++;
+    insert_free_block(heap, block);
+    return true;
+}
+
+// Блоки, освобождённые другими CPU, возвращаются владельцу при его следующем обращении
+static void arena_drain_remote(heap_t* heap) {
+    if (!heap->remote_free) return;
+
+    heap_block_t* block = __atomic_exchange_n(&heap->remote_free, NULL, __ATOMIC_ACQUIRE);
+    while (block) {
+        heap_block_t* next = free_links(block)->next_free;
+        arena_free(heap, block);
+        heap->stats.remote_drained++;
+        block = next;
+    }
+}
+
+static void arena_push_remote(heap_t* heap, heap_block_t* block) {
+    heap_block_t* head = __atomic_load_n(&heap->remote_free, __ATOMIC_RELAXED);
+    do {
+        free_links(block)->next_free = head;
+    } while (!__atomic_compare_exchange_n(&heap->remote_free, &head, block, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    __atomic_fetch_add(&heap->stats.remote_frees, 1, __ATOMIC_RELAXED);
+}
+
+static inline size_t heap_block_size(size_t size) {
+    size = (size + HEAP_ALIGNMENT - 1) & ~(HEAP_ALIGNMENT - 1);
+    return size < HEAP_MIN_BLOCK ? HEAP_MIN_BLOCK : size;
+}
+
+// Меняет размер занятого блока без переноса: хвост отдаётся соседу,
+// при росте поглощается свободный следующий блок (у последнего - после роста арены)
+static bool arena_resize(heap_t* heap, heap_block_t* block, size_t size) {
+    if (size <= block->size) {
+        heap->used_size -= split_block(heap, block, size);
+        heap->stats.shrinks_in_place++;
+        return true;
+    }
+
+    if (block == heap->last_block && !arena_grow(heap, size - block->size)) {
+        return false;
+    }
+
+    heap_block_t* next = block->next;
+    if (!next || next->used || block->size + sizeof(heap_block_t) + next->size < size) {
+        return false;
+    }
+
+    remove_free_block(heap, next);
+    size_t absorbed = next->size + sizeof(heap_block_t);
+    block->size += absorbed;
+    block->next = next->next;
+    if (next->next) next->next->prev = block;
+    if (heap->last_block == next) heap->last_block = block;
+    heap->block_count--;
+    heap->used_size += absorbed;
+
+    heap->used_size -= split_block(heap, block, size);
+    heap->stats.grows_in_place++;
+    return true;
+}
+
+void* kmalloc(size_t size) {
+    if (size == 0) return NULL;
+
+    // Мелкие объекты обслуживает slab без обхода списка блоков
+    if (size <= KMALLOC_SLAB_MAX) {
+        void* obj = kmem_alloc_small(size);
+        if (obj) {
+            ALLOC_TRACE(ALLOC_TRACE_ALLOC, obj, size);
+            return obj;
+        }
+    }
+
+    size = heap_block_size(size);
+
+    heap_t* home = current_arena();
+    uint64_t flags = arena_lock(home);
+    if (!home->initialized && !arena_init(home)) {
+        arena_unlock(home, flags);
+        home = NULL;
+    }
+
+    void* ptr = NULL;
+    if (home) {
+        arena_drain_remote(home);
+        ptr = arena_alloc(home, size);
+        if (!ptr && arena_grow(home, size)) {
+            ptr = arena_alloc(home, size);
+        }
+        arena_unlock(home, flags);
+    }
+
+    // Своя арена исчерпана - пробуем соседние
+    for (uint32_t i = 0; !ptr && i < HEAP_MAX_ARENAS; i++) {
+        heap_t* heap = &arenas[i];
+        if (heap == home || !heap->initialized) continue;
+
+        flags = arena_lock(heap);
+        arena_drain_remote(heap);
+        ptr = arena_alloc(heap, size);
+        if (ptr) heap->stats.foreign_allocs++;
+        arena_unlock(heap, flags);
+    }
+
+    if (!ptr) {
+        serial_puts("[HEAP] No free block found for size ");
+        char buf[32];
+        serial_puts(itoa(size, buf, 10));
+        serial_puts("\n");
+        return NULL;
+    }
+
+    ALLOC_TRACE(ALLOC_TRACE_ALLOC, ptr, size);
+    return ptr;
+}
+
+void kfree(void* ptr) {
+    if (!ptr) return;
+
+    if (!heap_contains(ptr)) {
+        ALLOC_TRACE(ALLOC_TRACE_FREE, ptr, kmem_object_size(ptr));
+        if (!kmem_free_small(ptr)) {
+            serial_puts("[HEAP] Invalid free at 0x");
+            char buf[32];
+            serial_puts(itoa((uint64_t)ptr, buf, 16));
+            serial_puts("\n");
+        }
+        return;
+    }
+
+    heap_block_t* block = (heap_block_t*)((uint8_t*)ptr - sizeof(heap_block_t));
+    if (!block->used || block->arena >= HEAP_MAX_ARENAS) {
+        serial_puts("[HEAP] Double free detected at 0x");
+        char buf[32];
+        serial_puts(itoa((uint64_t)ptr, buf, 16));
+        serial_puts("\n");
+        return;
+    }
+    ALLOC_TRACE(ALLOC_TRACE_FREE, ptr, block->size);
+
+    // Чужой блок не трогаем: кладём в очередь арены-владельца без блокировки
+    heap_t* owner = &arenas[block->arena];
+    if (owner != current_arena()) {
+        arena_push_remote(owner, block);
+        return;
+    }
+
+    uint64_t flags = arena_lock(owner);
+    arena_drain_remote(owner);
+    arena_free(owner, block);
+    arena_unlock(owner, flags);
 }
 
 void* kcalloc(size_t num, size_t size) {
@@ -168,66 +519,153 @@ void* krealloc(void* ptr, size_t size) {
         kfree(ptr);
         return NULL;
     }
-    
-    heap_block_t* block = (heap_block_t*)((uint8_t*)ptr - sizeof(heap_block_t));
-    if (size <= block->size) {
-        return ptr; 
+
+    size_t old_size;
+    if (heap_contains(ptr)) {
+        heap_block_t* block = (heap_block_t*)((uint8_t*)ptr - sizeof(heap_block_t));
+        if (!block->used || block->arena >= HEAP_MAX_ARENAS) {
+            serial_puts("[HEAP] Invalid realloc at 0x");
+            char buf[32];
+            serial_puts(itoa((uint64_t)ptr, buf, 16));
+            serial_puts("\n");
+            return NULL;
+        }
+
+        heap_t* owner = &arenas[block->arena];
+        uint64_t flags = arena_lock(owner);
+        arena_drain_remote(owner);
+        bool resized = arena_resize(owner, block, heap_block_size(size));
+        old_size = block->size;
+        arena_unlock(owner, flags);
+
+        if (resized) {
+            ALLOC_TRACE(ALLOC_TRACE_REALLOC, ptr, size);
+            return ptr;
+        }
+    } else {
+        old_size = kmem_object_size(ptr);
+        if (size <= old_size) {
+            ALLOC_TRACE(ALLOC_TRACE_REALLOC, ptr, size);
+            return ptr;
+        }
     }
-    
+
     void* new_ptr = kmalloc(size);
     if (new_ptr) {
-        memcpy(new_ptr, ptr, block->size);
+        memcpy(new_ptr, ptr, old_size < size ? old_size : size);
         kfree(ptr);
+        ALLOC_TRACE(ALLOC_TRACE_REALLOC, new_ptr, size);
     }
     return new_ptr;
 }
 
-size_t heap_get_total_size(void) { 
-    return kernel_heap.total_size; 
+size_t heap_get_total_size(void) {
+    size_t total = 0;
+    for (uint32_t i = 0; i < HEAP_MAX_ARENAS; i++) {
+        total += arenas[i].total_size;
+    }
+    return total;
+}
+
+size_t heap_get_used_size(void) {
+    size_t used = 0;
+    for (uint32_t i = 0; i < HEAP_MAX_ARENAS; i++) {
+        used += arenas[i].used_size;
+    }
+    return used;
 }
 
-size_t heap_get_used_size(void) { 
-    return kernel_heap.used_size; 
+size_t heap_get_free_size(void) {
+    return heap_get_total_size() - heap_get_used_size();
 }
 
-size_t heap_get_free_size(void) { 
-    return kernel_heap.total_size - kernel_heap.used_size; 
+bool heap_get_arena_stats(uint32_t arena, heap_arena_stats_t* stats) {
+    if (arena >= HEAP_MAX_ARENAS || !stats) return false;
+    *stats = arenas[arena].stats;
+    return arenas[arena].initialized;
+}
+
+void heap_dump_arena_stats(void) {
+    serial_puts("[HEAP] Arena statistics:\n");
+    for (uint32_t i = 0; i < HEAP_MAX_ARENAS; i++) {
+        heap_t* heap = &arenas[i];
+        if (!heap->initialized) continue;
+
+        char buf[32];
+        serial_puts("  Arena ");
+        serial_puts(itoa(i, buf, 10));
+        serial_puts(": allocs=");
+        serial_puts(itoa(heap->stats.allocs, buf, 10));
+        serial_puts(" frees=");
+        serial_puts(itoa(heap->stats.frees, buf, 10));
+        serial_puts(" remote=");
+        serial_puts(itoa(heap->stats.remote_frees, buf, 10));
+        serial_puts("/");
+        serial_puts(itoa(heap->stats.remote_drained, buf, 10));
+        serial_puts(" contended=");
+        serial_puts(itoa(heap->stats.lock_contended, buf, 10));
+        serial_puts(" foreign=");
+        serial_puts(itoa(heap->stats.foreign_allocs, buf, 10));
+        serial_puts(" grows=");
+        serial_puts(itoa(heap->stats.grows, buf, 10));
+        serial_puts(" returned=");
+        serial_puts(itoa(heap->stats.pages_returned, buf, 10));
+        serial_puts(" realloc=");
+        serial_puts(itoa(heap->stats.grows_in_place, buf, 10));
+        serial_puts("/");
+        serial_puts(itoa(heap->stats.shrinks_in_place, buf, 10));
+        serial_puts(" size=");
+        serial_puts(itoa(heap->total_size / 1024, buf, 10));
+        serial_puts(" KB\n");
+    }
 }
 
 void heap_dump_blocks(void) {
     serial_puts("[HEAP] Block dump:\n");
-    heap_block_t* current = kernel_heap.first_block;
     size_t i = 0;
     size_t total_used = 0;
     size_t total_free = 0;
-    
-    while (current) {
-        char buf[64];
-        serial_puts("  ");
-        serial_puts(itoa(i++, buf, 10));
-        serial_puts(": Addr=0x");
-        serial_puts(itoa((uint64_t)current, buf, 16));
-        serial_puts(" Size=");
-        serial_puts(itoa(current->size, buf, 10));
-        serial_puts(" Used=");
-        serial_puts(current->used ? "yes" : "no");
-        serial_puts("\n");
-        
-        if (current->used) {
-            total_used += current->size;
-        } else {
-            total_free += current->size;
+    size_t block_count = 0;
+
+    for (uint32_t arena = 0; arena < HEAP_MAX_ARENAS; arena++) {
+        heap_t* heap = &arenas[arena];
+        if (!heap->initialized) continue;
+
+        uint64_t flags = arena_lock(heap);
+        heap_block_t* current = heap->first_block;
+        block_count += heap->block_count;
+
+        while (current) {
+            char buf[64];
+            serial_puts("  ");
+            serial_puts(itoa(i++, buf, 10));
+            serial_puts(": Addr=0x");
+            serial_puts(itoa((uint64_t)current, buf, 16));
+            serial_puts(" Size=");
+            serial_puts(itoa(current->size, buf, 10));
+            serial_puts(" Used=");
+            serial_puts(current->used ? "yes" : "no");
+            serial_puts(" Arena=");
+            serial_puts(itoa(current->arena, buf, 10));
+            serial_puts("\n");
+
+            if (current->used) {
+                total_used += current->size;
+            } else {
+                total_free += current->size;
+            }
+
+            current = current->next;
         }
-        
-        current = current->next;
+        arena_unlock(heap, flags);
     }
-    
+
     serial_puts("[HEAP] Summary: ");
     char buf[32];
     serial_puts(itoa(total_used, buf, 10));
     serial_puts(" bytes used, ");
     serial_puts(itoa(total_free, buf, 10));
     serial_puts(" bytes free, ");
-    serial_puts(itoa(kernel_heap.block_count, buf, 10));
+    serial_puts(itoa(block_count, buf, 10));
     serial_puts(" blocks total\n");
-}
\ No newline at end of file
+}
@@ -0,0 +1,48 @@
+#include "include/memory/ioremap.h"
+#include "include/memory/paging.h"
+#include "include/memory/tlb.h"
+#include "include/drivers/serial.h"
+#include "libc/string.h"
+
+static uint64_t cache_flags(enum ioremap_cache cache) {
+    switch (cache) {
+        case IOREMAP_WC: return PAGING_CACHE_WC;
+        case IOREMAP_UC: return PAGING_CACHE_UC;
+        case IOREMAP_WT: return PAGING_CACHE_WT;
+        default:         return PAGING_CACHE_WB;
+    }
+}
+
+static inline page_table_t* kernel_pml4(void) {
+    return (page_table_t*)paging_physical_to_virtual(paging_get_cr3() & PAGING_ADDR_MASK);
+}
+
+void* ioremap(uint64_t phys, uint64_t size, enum ioremap_cache cache) {
+    if (!size) return NULL;
+
+    uint64_t start = phys & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    uint64_t end = (phys + size + PAGE_SIZE_4K - 1) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    uint64_t virt = (uint64_t)paging_physical_to_virtual(start);
+    uint64_t flags = PAGING_PRESENT | PAGING_WRITABLE | PAGING_NO_EXECUTE | PAGING_MMIO | cache_flags(cache);
+
+    if (!paging_map_range(virt, start, end - start, flags)) {
+        serial_puts("[IOREMAP] ERROR: Failed to map 0x");
+        char buf[32];
+        serial_puts(itoa(phys, buf, 16));
+        serial_puts("\n");
+        return NULL;
+    }
+
+    // Прежний тип памяти мог остаться в TLB других CPU
+    tlb_shootdown(kernel_pml4(), virt, end - start);
+    return (void*)(virt + (phys - start));
+}
+
+void iounmap(void* addr, uint64_t size) {
+    if (!addr || !size) return;
+
+    uint64_t start = (uint64_t)addr & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    uint64_t end = ((uint64_t)addr + size + PAGE_SIZE_4K - 1) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    // Листья с PAGING_MMIO не возвращаются в PMM
+    paging_unmap_range(start, end - start);
+}
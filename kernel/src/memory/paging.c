@@ -1,12 +1,31 @@
 #include "include/memory/paging.h"
 #include "include/memory/pmm.h"
-#include "include/memory/heap.h"
+#include "include/memory/page.h"
+#include "include/memory/vmalloc.h"
+#include "include/memory/vmm.h"
+#include "include/memory/alloc_trace.h"
+#include "include/memory/tlb.h"
 #include "include/drivers/serial.h"
 #include "libc/string.h"
 #include "libc/stdio.h"
 #include "include/interrupts/isr.h"
+#include "include/sys/hosted.h"
+#include "include/sys/spinlock.h"
 
 static volatile struct limine_hhdm_response *current_hhdm_response = NULL;
+static bool gbpages_supported = false;
+static bool pge_supported = false;
+static bool pcid_supported = false;
+static bool pat_supported = false;
+
+#define CR4_PGE   (1ULL << 7)
+#define CR4_PCIDE (1ULL << 17)
+
+#define MSR_PAT   0x277
+// PA0..PA7: WB, WT, UC-, UC, WC, WT, UC-, UC
+#define PAT_VALUE 0x0007040100070406ULL
+// Изменения таблиц страниц; чтение (lookup) идёт без блокировки
+static spinlock_t paging_lock = SPINLOCK_INIT;
 
 void paging_init(volatile struct limine_hhdm_response *hhdm_response) {
     serial_puts("[PAGING] Initializing...\n");
@@ -19,9 +38,15 @@ void paging_init(volatile struct limine_hhdm_response *hhdm_response) {
     }
     
     uint64_t cr0, cr4, cr3;
+#ifdef DEER_HOSTED
+    cr0 = 1UL << 31;
+    cr4 = 0;
+    cr3 = hosted_read_cr3();
+#else
     asm volatile("mov %%cr0, %0" : "=r"(cr0));
     asm volatile("mov %%cr4, %0" : "=r"(cr4));
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
+#endif
     
     char buffer[32];
     serial_puts("[PAGING] CR0: 0x");
@@ -39,12 +64,71 @@ void paging_init(volatile struct limine_hhdm_response *hhdm_response) {
     if (cr0 & (1UL << 31)) {
         serial_puts("[PAGING] Paging already enabled by bootloader\n");
     }
+
+    // Страницы 1 GiB (CPUID 0x80000001, EDX бит 26) используются только в paging_map_range
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0x80000001), "c"(0));
+    gbpages_supported = (edx >> 26) & 1;
+    if (gbpages_supported) {
+        serial_puts("[PAGING] 1 GiB pages supported\n");
+    }
+
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1), "c"(0));
+#ifndef DEER_HOSTED
+    pge_supported = (edx >> 13) & 1;
+    pcid_supported = pge_supported && ((ecx >> 17) & 1);
+    pat_supported = (edx >> 16) & 1;
+#endif
+    paging_init_cpu();
+    if (pcid_supported) {
+        serial_puts("[PAGING] PCID enabled\n");
+    }
+    if (pat_supported) {
+        serial_puts("[PAGING] PAT programmed, write-combining available\n");
+    }
     
     serial_puts("[PAGING] Ready\n");
 }
 
+void paging_init_cpu(void) {
+#ifndef DEER_HOSTED
+    uint64_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (pge_supported) cr4 |= CR4_PGE;
+
+    if (pcid_supported && !(cr4 & CR4_PCIDE)) {
+        // PCIDE можно включить, только когда в CR3 PCID 0
+        uint64_t cr3 = paging_get_cr3();
+        if (cr3 & 0xFFF) paging_load_cr3(cr3 & PAGING_ADDR_MASK);
+        cr4 |= CR4_PCIDE;
+    }
+    asm volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+
+    if (pat_supported) {
+        // PAT одинаков на всех CPU; старые строки кэша и TLB сбрасываются
+        asm volatile("wbinvd" ::: "memory");
+        asm volatile("wrmsr" :: "c"(MSR_PAT), "a"((uint32_t)PAT_VALUE),
+                     "d"((uint32_t)(PAT_VALUE >> 32)) : "memory");
+        paging_flush_tlb();
+    }
+#endif
+}
+
+bool paging_pcid_enabled(void) {
+    return pcid_supported;
+}
+
+bool paging_pat_enabled(void) {
+    return pat_supported;
+}
+
 void paging_load_cr3(uint64_t cr3_value) {
+#ifdef DEER_HOSTED
+    hosted_write_cr3(cr3_value);
+#else
     asm volatile("mov %0, %%cr3" :: "r"(cr3_value));
+#endif
+    tlb_set_active(cr3_value);
 }
 
 // handle double fault
@@ -55,148 +139,435 @@ void handle_double_fault(struct registers *regs) {
 }
 
 uint64_t paging_get_cr3(void) {
+#ifdef DEER_HOSTED
+    return hosted_read_cr3();
+#else
     uint64_t cr3;
     asm volatile("mov %%cr3, %0" : "=r"(cr3));
     return cr3;
+#endif
 }
 
 void paging_invalidate_tlb(uint64_t virtual_addr) {
+#ifdef DEER_HOSTED
+    (void)virtual_addr;
+#else
     asm volatile("invlpg (%0)" :: "r"(virtual_addr) : "memory");
+#endif
+}
+
+// Дальше этого числа страниц invlpg по одной дороже полного сброса TLB
+#define PAGING_FLUSH_MAX_PAGES 32
+
+void paging_flush_tlb(void) {
+#ifndef DEER_HOSTED
+    uint64_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    if (cr4 & CR4_PGE) {
+        // Переключение CR4.PGE сбрасывает глобальные записи и записи всех PCID
+        asm volatile("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+        asm volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+    } else {
+        paging_load_cr3(paging_get_cr3());
+    }
+#endif
+}
+
+void paging_invalidate_tlb_range(uint64_t virtual_addr, uint64_t size) {
+    if (size / PAGE_SIZE_4K > PAGING_FLUSH_MAX_PAGES) {
+        paging_flush_tlb();
+        return;
+    }
+    for (uint64_t offset = 0; offset < size; offset += PAGE_SIZE_4K) {
+        paging_invalidate_tlb(virtual_addr + offset);
+    }
+}
+
+#define PAGING_KERNEL_BASE 0xFFFFFFFF80000000ULL
+
+static inline page_table_t* current_pml4(void) {
+    return (page_table_t*)((paging_get_cr3() & PAGING_ADDR_MASK) + current_hhdm_response->offset);
+}
+
+static inline uint64_t table_index(uint64_t virtual_addr, uint32_t level) {
+    return (virtual_addr >> (12 + 9 * (level - 1))) & 0x1FF;
 }
 
-static page_table_t* get_next_table(page_table_t* current, uint64_t index, bool create) {
-    if (current->entries[index] & PAGING_PRESENT) {
-        uint64_t phys = current->entries[index] & ~0xFFF;
-        return (page_table_t*)(phys + current_hhdm_response->offset);
+static inline uint64_t level_page_size(uint32_t level) {
+    return 1ULL << (12 + 9 * (level - 1));
+}
+
+static inline uint64_t mark_table(uint64_t phys) {
+    struct page* page = phys ? phys_to_page(phys) : NULL;
+    if (page) page_set_owner(page, PAGE_FLAG_TABLE, 0, 0);
+    return phys;
+}
+
+// Разбивает большую страницу на таблицу из 512 страниц следующего уровня
+static bool split_large_page(page_table_entry_t* entry, uint32_t level, uint64_t virtual_addr) {
+    uint64_t phys = mark_table(pmm_alloc_page());
+    if (!phys) return false;
+
+    page_table_t* table = (page_table_t*)(phys + current_hhdm_response->offset);
+    uint64_t old = *entry;
+    uint64_t child_size = level_page_size(level - 1);
+    uint64_t base = old & PAGING_ADDR_MASK & ~(level_page_size(level) - 1);
+    uint64_t flags = old & ~PAGING_ADDR_MASK & ~PAGING_PAT_LARGE;
+
+    if (level - 1 == 1) {
+        // В 4 KiB записях PS отсутствует, а PAT живёт в бите 7
+        flags &= ~PAGING_HUGE_PAGE;
+        if (old & PAGING_PAT_LARGE) flags |= PAGING_HUGE_PAGE;
+    } else if (old & PAGING_PAT_LARGE) {
+        flags |= PAGING_PAT_LARGE;
+    }
+
+    for (uint64_t i = 0; i < 512; i++) {
+        table->entries[i] = (base + i * child_size) | flags;
+    }
+
+    *entry = phys | PAGING_PRESENT | PAGING_WRITABLE | (old & PAGING_USER);
+    paging_invalidate_tlb(virtual_addr & ~(level_page_size(level) - 1));
+    return true;
+}
+
+static page_table_t* get_next_table(page_table_t* current, uint64_t virtual_addr, uint32_t level,
+                                    bool create, uint64_t table_flags) {
+    page_table_entry_t* entry = &current->entries[table_index(virtual_addr, level)];
+
+    if (*entry & PAGING_PRESENT) {
+        if (*entry & PAGING_HUGE_PAGE) {
+            if (!create || !split_large_page(entry, level, virtual_addr)) return NULL;
+        }
+        *entry |= table_flags & PAGING_USER;
+        return (page_table_t*)((*entry & PAGING_ADDR_MASK) + current_hhdm_response->offset);
     }
     
     if (!create) return NULL;
     
-    uint64_t phys = pmm_alloc_page();
+    uint64_t phys = mark_table(pmm_alloc_zeroed_page());
     if (!phys) return NULL;
     
     page_table_t* next = (page_table_t*)(phys + current_hhdm_response->offset);
-    memset(next, 0, PAGE_SIZE_4K);
     
-    current->entries[index] = phys | PAGING_PRESENT | PAGING_WRITABLE;
+    *entry = phys | PAGING_PRESENT | PAGING_WRITABLE | (table_flags & PAGING_USER);
     return next;
 }
 
-bool paging_map_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags) {
-    if (!current_hhdm_response) return false;
-    
-    uint64_t cr3 = paging_get_cr3();
-    page_table_t* pml4 = (page_table_t*)(cr3 + current_hhdm_response->offset);
-    
-    uint64_t pml4_index = (virtual_addr >> 39) & 0x1FF;
-    uint64_t pdp_index = (virtual_addr >> 30) & 0x1FF;
-    uint64_t pd_index = (virtual_addr >> 21) & 0x1FF;
-    uint64_t pt_index = (virtual_addr >> 12) & 0x1FF;
-    
-    page_table_t* pdp = get_next_table(pml4, pml4_index, true);
-    if (!pdp) return false;
-    
-    page_table_t* pd = get_next_table(pdp, pdp_index, true);
-    if (!pd) return false;
-    
-    page_table_t* pt = get_next_table(pd, pd_index, true);
-    if (!pt) return false;
-    
-    pt->entries[pt_index] = physical_addr | flags | PAGING_PRESENT;
+// Верхняя половина одинакова во всех пространствах: её листья глобальные и
+// не вытесняются сменой CR3 (с PCID invlpg сбрасывает чужие PCID только для них)
+static inline uint64_t leaf_flags(uint64_t virtual_addr, uint64_t flags, uint32_t level) {
+    if (pge_supported && virtual_addr >= PAGING_KERNEL_HALF) flags |= PAGING_GLOBAL;
+    if (flags & PAGING_PAT_LARGE) {
+        // Без PAT вместо WC остаётся только UC
+        flags &= ~PAGING_PAT_LARGE;
+        if (!pat_supported) flags |= PAGING_CACHE_UC;
+        else flags |= level == 1 ? PAGING_PAT_4K : PAGING_PAT_LARGE;
+    }
+    return flags;
+}
+
+static uint32_t leaf_level(uint64_t page_size) {
+    switch (page_size) {
+        case PAGE_SIZE_4K: return 1;
+        case PAGE_SIZE_2M: return 2;
+        case PAGE_SIZE_1G: return 3;
+        default: return 0;
+    }
+}
+
+static bool map_in_locked(page_table_t* pml4, uint64_t virtual_addr, uint64_t physical_addr,
+                          uint64_t page_size, uint64_t flags) {
+    uint32_t leaf = leaf_level(page_size);
+    if (!leaf) return false;
+    if ((virtual_addr | physical_addr) & (page_size - 1)) {
+        serial_puts("[PAGING] Unaligned large page mapping\n");
+        return false;
+    }
+
+    page_table_t* table = pml4;
+    for (uint32_t level = 4; level > leaf; level--) {
+        table = get_next_table(table, virtual_addr, level, true, flags);
+        if (!table) return false;
+    }
+
+    page_table_entry_t* entry = &table->entries[table_index(virtual_addr, leaf)];
+
+    // Большая страница поверх таблицы: освобождаем только саму таблицу
+    if (leaf > 1 && (*entry & PAGING_PRESENT) && !(*entry & PAGING_HUGE_PAGE)) {
+        serial_puts("[PAGING] Large page would replace a page table at 0x");
+        char buf[32];
+        serial_puts(itoa(virtual_addr, buf, 16));
+        serial_puts("\n");
+        return false;
+    }
+
+    *entry = physical_addr | leaf_flags(virtual_addr, flags, leaf) | PAGING_PRESENT | (leaf > 1 ? PAGING_HUGE_PAGE : 0);
     paging_invalidate_tlb(virtual_addr);
-    
+#ifdef DEER_HOSTED
+    hosted_page_mapped(pml4, virtual_addr, physical_addr, page_size);
+#endif
+    return true;
+}
+
+bool paging_map_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t physical_addr,
+                   uint64_t page_size, uint64_t flags) {
+    if (!current_hhdm_response || !pml4) return false;
+
+    uint64_t irq = spin_lock_irqsave(&paging_lock);
+    bool mapped = map_in_locked(pml4, virtual_addr, physical_addr, page_size, flags);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return mapped;
+}
+
+page_table_entry_t* paging_lookup_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t* page_size) {
+    if (!current_hhdm_response || !pml4) return NULL;
+
+    page_table_t* table = pml4;
+    for (uint32_t level = 4; level >= 1; level--) {
+        page_table_entry_t* entry = &table->entries[table_index(virtual_addr, level)];
+        if (!(*entry & PAGING_PRESENT)) return NULL;
+
+        if (level == 1 || (level < 4 && (*entry & PAGING_HUGE_PAGE))) {
+            if (page_size) *page_size = level_page_size(level);
+            return entry;
+        }
+        table = (page_table_t*)((*entry & PAGING_ADDR_MASK) + current_hhdm_response->offset);
+    }
+    return NULL;
+}
+
+// Два CPU могут одновременно промахнуться по одной странице:
+// второй не должен подменять уже отображённый кадр
+bool paging_map_absent_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags) {
+    if (!current_hhdm_response || !pml4) return false;
+
+    uint64_t irq = spin_lock_irqsave(&paging_lock);
+    bool mapped = !paging_lookup_in(pml4, virtual_addr, NULL) &&
+                  map_in_locked(pml4, virtual_addr, physical_addr, PAGE_SIZE_4K, flags);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return mapped;
+}
+
+static bool unmap_in_locked(page_table_t* pml4, uint64_t virtual_addr, struct tlb_gather* gather) {
+    uint64_t page_size = 0;
+    page_table_entry_t* entry = paging_lookup_in(pml4, virtual_addr, &page_size);
+    if (!entry) return false;
+
+    // Снимаем 4 KiB из середины большой страницы - сначала разбиваем её
+    while (page_size > PAGE_SIZE_4K && (virtual_addr & (page_size - 1))) {
+        if (!split_large_page(entry, leaf_level(page_size), virtual_addr)) return false;
+        entry = paging_lookup_in(pml4, virtual_addr, &page_size);
+        if (!entry) return false;
+    }
+
+    uint64_t base = virtual_addr & ~(page_size - 1);
+    uint64_t phys = (*entry & PAGING_MMIO) ? 0 : *entry & PAGING_ADDR_MASK & ~(page_size - 1);
+    *entry = 0;
+#ifdef DEER_HOSTED
+    hosted_page_unmapped(pml4, base, page_size);
+#endif
+    tlb_gather_add(gather, base, page_size, phys);
+
+    return true;
+}
+
+bool paging_unmap_in(page_table_t* pml4, uint64_t virtual_addr) {
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, pml4);
+
+    uint64_t irq = spin_lock_irqsave(&paging_lock);
+    bool unmapped = unmap_in_locked(pml4, virtual_addr, &gather);
+    spin_unlock_irqrestore(&paging_lock, irq);
+
+    // Кадр уходит в PMM только после сброса TLB на всех CPU
+    tlb_gather_flush(&gather);
+    return unmapped;
+}
+
+// Снимает листья в [*virtual_addr, end) одной таблицы и её потомков.
+// Останавливается, когда gather заполнен; без gather кадры остаются
+// у вызывающего (откат paging_map_range)
+static bool unmap_range_level(page_table_t* pml4, page_table_t* table, uint32_t level,
+                              uint64_t* virtual_addr, uint64_t end, struct tlb_gather* gather) {
+    uint64_t size = level_page_size(level);
+
+    for (uint64_t i = table_index(*virtual_addr, level); i < 512 && *virtual_addr < end; i++) {
+        if (gather && tlb_gather_full(gather)) return true;
+
+        page_table_entry_t* entry = &table->entries[i];
+        uint64_t next = (*virtual_addr & ~(size - 1)) + size;
+
+        if (!(*entry & PAGING_PRESENT)) {
+            *virtual_addr = next;
+            continue;
+        }
+
+        if (level == 1 || (level < 4 && (*entry & PAGING_HUGE_PAGE))) {
+            bool partial = (*virtual_addr & (size - 1)) || end - *virtual_addr < size;
+            if (!partial) {
+                uint64_t phys = (*entry & PAGING_MMIO) ? 0 : *entry & PAGING_ADDR_MASK & ~(size - 1);
+                *entry = 0;
+#ifdef DEER_HOSTED
+                hosted_page_unmapped(pml4, *virtual_addr, size);
+#endif
+                if (gather) tlb_gather_add(gather, *virtual_addr, size, phys);
+                *virtual_addr = next;
+                continue;
+            }
+            // Диапазон задевает большую страницу частично - разбиваем и спускаемся
+            if (!split_large_page(entry, level, *virtual_addr)) return false;
+        }
+
+        page_table_t* child = (page_table_t*)((*entry & PAGING_ADDR_MASK) + current_hhdm_response->offset);
+        if (!unmap_range_level(pml4, child, level - 1, virtual_addr, end, gather)) return false;
+    }
+    return true;
+}
+
+static bool can_map_leaf(uint32_t level, uint64_t virtual_addr, uint64_t physical_addr, uint64_t end,
+                         page_table_entry_t entry) {
+    if (level == 1) return true;
+    if (level == 3 && !gbpages_supported) return false;
+    if (level > 3) return false;
+
+    uint64_t size = level_page_size(level);
+    if ((virtual_addr | physical_addr) & (size - 1)) return false;
+    if (end - virtual_addr < size) return false;
+    // Уже существующую таблицу большой страницей не заменяем
+    return !(entry & PAGING_PRESENT) || (entry & PAGING_HUGE_PAGE);
+}
+
+// Один проход по каждой таблице: индекс идёт до конца таблицы или диапазона
+static bool map_range_level(page_table_t* pml4, page_table_t* table, uint32_t level,
+                            uint64_t* virtual_addr, uint64_t* physical_addr, uint64_t end, uint64_t flags) {
+    uint64_t size = level_page_size(level);
+
+    for (uint64_t i = table_index(*virtual_addr, level); i < 512 && *virtual_addr < end; i++) {
+        page_table_entry_t* entry = &table->entries[i];
+
+        if (can_map_leaf(level, *virtual_addr, *physical_addr, end, *entry)) {
+            *entry = *physical_addr | leaf_flags(*virtual_addr, flags, level) | PAGING_PRESENT | (level > 1 ? PAGING_HUGE_PAGE : 0);
+#ifdef DEER_HOSTED
+            hosted_page_mapped(pml4, *virtual_addr, *physical_addr, size);
+#endif
+            *virtual_addr += size;
+            *physical_addr += size;
+            continue;
+        }
+
+        page_table_t* child = get_next_table(table, *virtual_addr, level, true, flags);
+        if (!child) return false;
+        if (!map_range_level(pml4, child, level - 1, virtual_addr, physical_addr, end, flags)) return false;
+    }
     return true;
 }
 
+bool paging_map_range_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t physical_addr,
+                         uint64_t size, uint64_t flags) {
+    if (!current_hhdm_response || !pml4 || !size) return false;
+    if ((virtual_addr | physical_addr | size) & (PAGE_SIZE_4K - 1)) {
+        serial_puts("[PAGING] Unaligned range mapping\n");
+        return false;
+    }
+
+    uint64_t end = virtual_addr + size;
+    uint64_t cursor = virtual_addr;
+    uint64_t physical = physical_addr;
+
+    uint64_t irq = spin_lock_irqsave(&paging_lock);
+    bool mapped = map_range_level(pml4, pml4, 4, &cursor, &physical, end, flags);
+    if (!mapped) {
+        // Не хватило памяти под таблицы: убираем то, что успели отобразить
+        uint64_t rollback = virtual_addr;
+        unmap_range_level(pml4, pml4, 4, &rollback, cursor, NULL);
+        serial_puts("[PAGING] ERROR: Failed to map range at 0x");
+        char buf[32];
+        serial_puts(itoa(virtual_addr, buf, 16));
+        serial_puts("\n");
+    }
+    paging_invalidate_tlb_range(virtual_addr, size);
+    spin_unlock_irqrestore(&paging_lock, irq);
+    return mapped;
+}
+
+uint64_t paging_unmap_range_in(page_table_t* pml4, uint64_t virtual_addr, uint64_t size) {
+    if (!current_hhdm_response || !pml4 || !size) return 0;
+
+    uint64_t start = virtual_addr & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    uint64_t end = (virtual_addr + size + PAGE_SIZE_4K - 1) & ~(uint64_t)(PAGE_SIZE_4K - 1);
+    uint64_t cursor = start;
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, pml4);
+
+    // Shootdown ждёт другие CPU, поэтому между порциями paging_lock отпускается
+    while (cursor < end) {
+        uint64_t irq = spin_lock_irqsave(&paging_lock);
+        bool unmapped = unmap_range_level(pml4, pml4, 4, &cursor, end, &gather);
+        spin_unlock_irqrestore(&paging_lock, irq);
+
+        tlb_gather_flush(&gather);
+        if (!unmapped) {
+            serial_puts("[PAGING] ERROR: Failed to split a large page while unmapping\n");
+            break;
+        }
+    }
+    return gather.freed_pages;
+}
+
+bool paging_map_range(uint64_t virtual_addr, uint64_t physical_addr, uint64_t size, uint64_t flags) {
+    if (!current_hhdm_response) return false;
+    return paging_map_range_in(current_pml4(), virtual_addr, physical_addr, size, flags);
+}
+
+uint64_t paging_unmap_range(uint64_t virtual_addr, uint64_t size) {
+    if (!current_hhdm_response) return 0;
+    return paging_unmap_range_in(current_pml4(), virtual_addr, size);
+}
+
+bool paging_map_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags) {
+    if (!current_hhdm_response) return false;
+    return paging_map_in(current_pml4(), virtual_addr, physical_addr, PAGE_SIZE_4K, flags);
+}
+
+bool paging_map_large_page(uint64_t virtual_addr, uint64_t physical_addr, uint64_t page_size, uint64_t flags) {
+    if (!current_hhdm_response) return false;
+    return paging_map_in(current_pml4(), virtual_addr, physical_addr, page_size, flags);
+}
+
 bool paging_unmap_page(uint64_t virtual_addr) {
     if (!current_hhdm_response) return false;
-    
-    uint64_t cr3 = paging_get_cr3();
-    page_table_t* pml4 = (page_table_t*)(cr3 + current_hhdm_response->offset);
-    
-    uint64_t pml4_index = (virtual_addr >> 39) & 0x1FF;
-    uint64_t pdp_index = (virtual_addr >> 30) & 0x1FF;
-    uint64_t pd_index = (virtual_addr >> 21) & 0x1FF;
-    uint64_t pt_index = (virtual_addr >> 12) & 0x1FF;
-    
-    page_table_t* pdp = get_next_table(pml4, pml4_index, false);
-    if (!pdp) return false;
-    
-    page_table_t* pd = get_next_table(pdp, pdp_index, false);
-    if (!pd) return false;
-    
-    page_table_t* pt = get_next_table(pd, pd_index, false);
-    if (!pt) return false;
-    
-    if (!(pt->entries[pt_index] & PAGING_PRESENT)) return false;
-    
-    pmm_free_page(pt->entries[pt_index] & ~0xFFF);
-    pt->entries[pt_index] = 0;
-    paging_invalidate_tlb(virtual_addr);
-    
-    return true;
+    return paging_unmap_in(current_pml4(), virtual_addr);
 }
 
 bool paging_is_mapped(uint64_t virtual_addr) {
     if (!current_hhdm_response) return false;
-    
-    uint64_t cr3 = paging_get_cr3();
-    page_table_t* pml4 = (page_table_t*)(cr3 + current_hhdm_response->offset);
-    
-    uint64_t pml4_index = (virtual_addr >> 39) & 0x1FF;
-    if (!(pml4->entries[pml4_index] & PAGING_PRESENT)) return false;
-    
-    page_table_t* pdp = get_next_table(pml4, pml4_index, false);
-    if (!pdp) return false;
-    
-    uint64_t pdp_index = (virtual_addr >> 30) & 0x1FF;
-    if (!(pdp->entries[pdp_index] & PAGING_PRESENT)) return false;
-    
-    page_table_t* pd = get_next_table(pdp, pdp_index, false);
-    if (!pd) return false;
-    
-    uint64_t pd_index = (virtual_addr >> 21) & 0x1FF;
-    if (!(pd->entries[pd_index] & PAGING_PRESENT)) return false;
-    
-    page_table_t* pt = get_next_table(pd, pd_index, false);
-    if (!pt) return false;
-    
-    uint64_t pt_index = (virtual_addr >> 12) & 0x1FF;
-    return (pt->entries[pt_index] & PAGING_PRESENT) != 0;
+    return paging_lookup_in(current_pml4(), virtual_addr, NULL) != NULL;
+}
+
+uint64_t paging_get_page_size(uint64_t virtual_addr) {
+    if (!current_hhdm_response) return 0;
+
+    uint64_t page_size = 0;
+    if (!paging_lookup_in(current_pml4(), virtual_addr, &page_size)) return 0;
+    return page_size;
 }
 
 uint64_t paging_get_physical_address(uint64_t virtual_addr) {
     if (!current_hhdm_response) return 0;
     
-    if (virtual_addr >= current_hhdm_response->offset) {
+    // Ядро и куча лежат выше HHDM, их адреса нужно искать в таблицах
+    if (virtual_addr >= current_hhdm_response->offset && virtual_addr < PAGING_KERNEL_BASE) {
         return virtual_addr - current_hhdm_response->offset;
     }
     
-    uint64_t cr3 = paging_get_cr3();
-    page_table_t* pml4 = (page_table_t*)(cr3 + current_hhdm_response->offset);
-    
-    uint64_t pml4_index = (virtual_addr >> 39) & 0x1FF;
-    if (!(pml4->entries[pml4_index] & PAGING_PRESENT)) return 0;
-    
-    page_table_t* pdp = get_next_table(pml4, pml4_index, false);
-    if (!pdp) return 0;
-    
-    uint64_t pdp_index = (virtual_addr >> 30) & 0x1FF;
-    if (!(pdp->entries[pdp_index] & PAGING_PRESENT)) return 0;
+    uint64_t page_size = 0;
+    page_table_entry_t* entry = paging_lookup_in(current_pml4(), virtual_addr, &page_size);
+    if (!entry) return 0;
     
-    page_table_t* pd = get_next_table(pdp, pdp_index, false);
-    if (!pd) return 0;
-    
-    uint64_t pd_index = (virtual_addr >> 21) & 0x1FF;
-    if (!(pd->entries[pd_index] & PAGING_PRESENT)) return 0;
-    
-    page_table_t* pt = get_next_table(pd, pd_index, false);
-    if (!pt) return 0;
-    
-    uint64_t pt_index = (virtual_addr >> 12) & 0x1FF;
-    if (!(pt->entries[pt_index] & PAGING_PRESENT)) return 0;
-    
-    return pt->entries[pt_index] & ~0xFFF;
+    // Для больших страниц добавляем смещение внутри страницы сверх 4 KiB
+    uint64_t base = *entry & PAGING_ADDR_MASK & ~(page_size - 1);
+    return base | (virtual_addr & (page_size - 1) & ~0xFFFULL);
 }
 
 void* paging_physical_to_virtual(uint64_t physical_addr) {
@@ -210,26 +581,151 @@ uint64_t paging_virtual_to_physical(void* virtual_addr) {
     return paging_get_physical_address((uint64_t)virtual_addr);
 }
 
+static uint64_t alloc_frames(uint64_t size) {
+    if (size == PAGE_SIZE_4K) return pmm_alloc_page();
+    return pmm_alloc_pages_aligned(size / PAGE_SIZE_4K, size);
+}
+
+// Лист разделяется между пространствами; кадр вне PMM (его нельзя
+// учесть в struct page) копируется сразу
+static bool clone_leaf(page_table_entry_t* dst, page_table_entry_t* src, uint64_t size) {
+    uint64_t entry = *src;
+    uint64_t phys = entry & PAGING_ADDR_MASK & ~(size - 1);
+
+    if (entry & PAGING_MMIO) {
+        *dst = entry;
+        return true;
+    }
+
+    if (!pmm_share_pages(phys, size / PAGE_SIZE_4K)) {
+        uint64_t copy = alloc_frames(size);
+        if (!copy) return false;
+        memcpy((void*)(copy + current_hhdm_response->offset),
+               (void*)(phys + current_hhdm_response->offset), size);
+        *dst = copy | (entry & ~(PAGING_ADDR_MASK & ~(size - 1)));
+        return true;
+    }
+
+    if (entry & PAGING_WRITABLE) {
+        entry = (entry & ~PAGING_WRITABLE) | PAGING_COW;
+        *src = entry;
+    }
+    *dst = entry;
+    return true;
+}
+
+static bool clone_level(page_table_t* dst, page_table_t* src, uint32_t level) {
+    uint64_t count = level == 4 ? 256 : 512;
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t entry = src->entries[i];
+        if (!(entry & PAGING_PRESENT)) continue;
+
+        if (level == 1 || (entry & PAGING_HUGE_PAGE)) {
+            if (!clone_leaf(&dst->entries[i], &src->entries[i], level_page_size(level))) return false;
+            continue;
+        }
+
+        uint64_t phys = mark_table(pmm_alloc_zeroed_page());
+        if (!phys) return false;
+        dst->entries[i] = phys | (entry & ~PAGING_ADDR_MASK);
+
+        page_table_t* child = (page_table_t*)(phys + current_hhdm_response->offset);
+        page_table_t* source = (page_table_t*)((entry & PAGING_ADDR_MASK) + current_hhdm_response->offset);
+        if (!clone_level(child, source, level - 1)) return false;
+    }
+    return true;
+}
+
+bool paging_clone_user_in(page_table_t* dst, page_table_t* src) {
+    uint64_t irq = spin_lock_irqsave(&paging_lock);
+    bool ok = clone_level(dst, src, 4);
+    spin_unlock_irqrestore(&paging_lock, irq);
+
+    // Записи src стали только для чтения даже при неудаче
+    tlb_shootdown(src, 0, PAGING_USER_END);
+    return ok;
+}
+
+// Большая страница могла быть разбита в другом пространстве, и её части
+// разделены по-разному: проверяем каждый кадр
+static bool frames_exclusive(uint64_t phys, uint64_t size) {
+    struct page* page = phys_to_page(phys);
+    if (!page) return false;
+
+    for (uint64_t i = 0; i < size / PAGE_SIZE_4K; i++) {
+        if (page_owners(&page[i]) != 1) return false;
+    }
+    return true;
+}
+
+// Запись в COW-страницу: последний владелец забирает кадр себе, остальные
+// получают копию. Старый кадр отпускается только после shootdown
+static bool break_cow(uint64_t fault_address) {
+    page_table_t* pml4 = current_pml4();
+    uint64_t size = 0;
+    uint64_t copy = 0;
+
+    uint64_t irq = spin_lock_irqsave(&paging_lock);
+    page_table_entry_t* entry = paging_lookup_in(pml4, fault_address, &size);
+    if (!entry || !(*entry & (PAGING_COW | PAGING_WRITABLE))) {
+        spin_unlock_irqrestore(&paging_lock, irq);
+        return false;
+    }
+
+    uint64_t base = fault_address & ~(size - 1);
+    if (*entry & PAGING_WRITABLE) {
+        // Другой CPU уже разделил страницу, у нас устаревшая запись TLB
+        spin_unlock_irqrestore(&paging_lock, irq);
+        paging_invalidate_tlb(base);
+        return true;
+    }
+
+    uint64_t phys = *entry & PAGING_ADDR_MASK & ~(size - 1);
+    uint64_t attrs = (*entry & ~(PAGING_ADDR_MASK & ~(size - 1)) & ~PAGING_COW) | PAGING_WRITABLE;
+    if (frames_exclusive(phys, size)) {
+        *entry = phys | attrs;
+        spin_unlock_irqrestore(&paging_lock, irq);
+        paging_invalidate_tlb(base);
+        return true;
+    }
+
+    copy = alloc_frames(size);
+    if (!copy) {
+        spin_unlock_irqrestore(&paging_lock, irq);
+        serial_puts("[PAGING] Out of memory breaking COW\n");
+        return false;
+    }
+    memcpy((void*)(copy + current_hhdm_response->offset),
+           (void*)(phys + current_hhdm_response->offset), size);
+    *entry = copy | attrs;
+    spin_unlock_irqrestore(&paging_lock, irq);
+
+    struct tlb_gather gather;
+    tlb_gather_init(&gather, pml4);
+    tlb_gather_add(&gather, base, size, phys);
+    tlb_gather_flush(&gather);
+    return true;
+}
+
 void handle_page_fault(struct registers *regs) {
     (void)regs; 
     uint64_t fault_address;
     uint64_t error_code = regs->err_code;
     
+#ifdef DEER_HOSTED
+    fault_address = hosted_read_cr2();
+#else
     asm volatile("mov %%cr2, %0" : "=r"(fault_address));
+#endif
     
     if (!(error_code & 0x1)) { 
-        if (fault_address >= HEAP_START && fault_address < HEAP_START + HEAP_MAX_SIZE) {
-            uint64_t page_base = fault_address & ~0xFFF;
-            uint64_t phys = pmm_alloc_page();
-            if (phys && paging_map_page(page_base, phys, PAGING_PRESENT | PAGING_WRITABLE)) {
-                serial_puts("[PAGING] Auto-mapped heap page at 0x");
-                char buf[32];
-                serial_puts(itoa(page_base, buf, 16));
-                serial_puts("\n");
-                memset((void*)page_base, 0, PAGE_SIZE_4K);
-                return;
-            }
+        if (vmm_handle_fault(fault_address, error_code)) {
+            ALLOC_TRACE_AT(ALLOC_TRACE_FAULT, regs->rip, (void*)(fault_address & ~0xFFFULL), PAGE_SIZE_4K);
+            return;
         }
+    } else if ((error_code & 0x2) && break_cow(fault_address)) {
+        return;
     }
     
     printf("\nPAGE FAULT\n");
@@ -238,12 +734,18 @@ void handle_page_fault(struct registers *regs) {
     
     if (error_code & 0x1) {
         printf("Type: Protection Violation\n");
+    } else if (vmalloc_is_guard(fault_address)) {
+        printf("Type: vmalloc Guard Page (stack overflow?)\n");
     } else {
         printf("Type: Page Not Present\n");
     }
     
     printf("Unrecoverable page fault - System Halted\n");
+#ifdef DEER_HOSTED
+    hosted_halt();
+#else
     for(;;) asm volatile("hlt");
+#endif
 }
 
 void handle_general_protection_fault(struct registers *regs) {
@@ -256,5 +758,9 @@ void handle_general_protection_fault(struct registers *regs) {
     }
     
     printf("Critical GPF - System Halted\n");
+#ifdef DEER_HOSTED
+    hosted_halt();
+#else
     for(;;) asm volatile("hlt");
+#endif
 }
\ No newline at end of file
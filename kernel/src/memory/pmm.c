@@ -1,81 +1,279 @@
 #include "include/memory/pmm.h"
+#include "include/memory/page.h"
+#include "include/sys/smp.h"
+#include "include/sys/spinlock.h"
 #include "include/drivers/serial.h"
 #include "libc/string.h"
 #include "libc/stdio.h"
 
+struct free_block {
+    struct free_block *next;
+    struct free_block *prev;
+    uint32_t order;
+};
+
+// Отдельный buddy-аллокатор на каждый NUMA-узел
+struct pmm_node {
+    spinlock_t lock;
+    struct free_block *free_lists[PMM_MAX_ORDER + 1];
+    uint64_t free_counts[PMM_MAX_ORDER + 1];
+    uint32_t free_mask;
+    uint64_t free_pages;
+    uint64_t present_pages;
+    uint8_t fallback[PMM_MAX_NODES];
+    uint32_t fallback_count;
+} __attribute__((aligned(64)));
+
 static volatile struct limine_memmap_response *current_memmap = NULL;
 static volatile struct limine_hhdm_response *current_hhdm = NULL;
 
-static uint8_t* bitmap = NULL;
-static uint64_t bitmap_size = 0;
-static uint64_t total_pages = 0;
-static uint64_t used_pages = 0;
+// Описатели всех кадров до самого старшего USABLE-адреса
+struct page *pmm_pages = NULL;
+uint64_t pmm_page_count = 0;
+static uint64_t metadata_size = 0;
 static uint64_t total_memory = 0;
 
-static void bitmap_set(uint64_t bit) {
-    uint64_t byte = bit / 8;
-    uint64_t offset = bit % 8;
-    bitmap[byte] |= (1 << offset);
-    used_pages++;
-}
-
-static void bitmap_clear(uint64_t bit) {
-    uint64_t byte = bit / 8;
-    uint64_t offset = bit % 8;
-    bitmap[byte] &= ~(1 << offset);
-    used_pages--;
-}
-
-static bool bitmap_test(uint64_t bit) {
-    uint64_t byte = bit / 8;
-    uint64_t offset = bit % 8;
-    return (bitmap[byte] & (1 << offset)) != 0;
-}
-
-static uint64_t find_free_pages(size_t count) {
-    uint64_t consecutive = 0;
-    uint64_t start_page = 0;
-    
-    for (uint64_t i = 1; i < total_pages; i++) {
-        if (!bitmap_test(i)) {
-            bool usable = false;
-            for (uint64_t j = 0; j < current_memmap->entry_count; j++) {
-                struct limine_memmap_entry* entry = current_memmap->entries[j];
-                if (entry->type == LIMINE_MEMMAP_USABLE) {
-                    uint64_t page_addr = i * PAGE_SIZE;
-                    if (page_addr >= entry->base && page_addr < entry->base + entry->length) {
-                        usable = true;
-                        break;
-                    }
-                }
-            }
-            
-            if (usable) {
-                if (consecutive == 0) start_page = i;
-                consecutive++;
-                if (consecutive == count) return start_page;
-            } else {
-                consecutive = 0;
+static struct pmm_node nodes[PMM_MAX_NODES];
+static uint32_t node_count = 1;
+
+// Магазин 4 KiB страниц на каждый CPU: кольцо, горячий конец - tail, холодный - head
+struct pmm_pcp {
+    uint64_t pages[PMM_PCP_SIZE];
+    uint32_t head;
+    uint32_t count;
+    struct pmm_pcp_stats stats;
+} __attribute__((aligned(64)));
+
+static struct pmm_pcp pcp_caches[MAX_CPUS];
+
+// Запас заранее обнулённых страниц; пополняется из idle-циклов
+static spinlock_t zero_lock = SPINLOCK_INIT;
+static uint64_t zero_pool[PMM_ZERO_POOL_SIZE];
+static volatile uint32_t zero_count = 0;
+static struct pmm_zero_stats zero_stats;
+
+static inline struct free_block *pfn_to_block(uint64_t pfn) {
+    return (struct free_block*)(pfn * PAGE_SIZE + current_hhdm->offset);
+}
+
+static inline uint64_t block_to_pfn(struct free_block *block) {
+    return ((uint64_t)block - current_hhdm->offset) / PAGE_SIZE;
+}
+
+static inline uint8_t local_node(void) {
+    uint8_t node = smp_state.cpus[smp_current_cpu_id()].numa_node;
+    return node < node_count ? node : 0;
+}
+
+static void free_list_push(struct pmm_node *node, uint64_t pfn, uint32_t order) {
+    struct free_block *block = pfn_to_block(pfn);
+    block->prev = NULL;
+    block->next = node->free_lists[order];
+    block->order = order;
+    if (node->free_lists[order]) {
+        node->free_lists[order]->prev = block;
+    }
+    node->free_lists[order] = block;
+    node->free_counts[order]++;
+    node->free_mask |= (1U << order);
+    pmm_pages[pfn].state = PAGE_STATE_USABLE | PAGE_STATE_FREE | order;
+}
+
+static void free_list_remove(struct pmm_node *node, uint64_t pfn, uint32_t order) {
+    struct free_block *block = pfn_to_block(pfn);
+    if (block->prev) {
+        block->prev->next = block->next;
+    } else {
+        node->free_lists[order] = block->next;
+    }
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+    if (--node->free_counts[order] == 0) {
+        node->free_mask &= ~(1U << order);
+    }
+    pmm_pages[pfn].state = PAGE_STATE_USABLE;
+}
+
+static inline bool is_free_head(uint64_t pfn, uint32_t order, uint8_t node) {
+    return pfn < pmm_page_count &&
+           pmm_pages[pfn].state == (PAGE_STATE_USABLE | PAGE_STATE_FREE | order) &&
+           pmm_pages[pfn].node == node;
+}
+
+static void buddy_free_block(struct pmm_node *node, uint64_t pfn, uint32_t order) {
+    uint8_t id = (uint8_t)(node - nodes);
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = pfn ^ (1ULL << order);
+        if (!is_free_head(buddy, order, id)) break;
+
+        free_list_remove(node, buddy, order);
+        pfn &= ~(1ULL << order);
+        order++;
+    }
+    free_list_push(node, pfn, order);
+}
+
+static uint64_t buddy_alloc_block(struct pmm_node *node, uint32_t order) {
+    uint32_t candidates = node->free_mask & ~((1U << order) - 1);
+    if (!candidates) return (uint64_t)-1;
+
+    uint32_t current = __builtin_ctz(candidates);
+    uint64_t pfn = block_to_pfn(node->free_lists[current]);
+    free_list_remove(node, pfn, current);
+
+    // Делим блок пополам, пока не дойдём до нужного порядка
+    while (current > order) {
+        current--;
+        free_list_push(node, pfn + (1ULL << current), current);
+    }
+    return pfn;
+}
+
+// Разбивает диапазон на выровненные блоки максимального размера
+static void buddy_free_range(struct pmm_node *node, uint64_t pfn, uint64_t count) {
+    while (count) {
+        uint32_t order = pfn ? __builtin_ctzll(pfn) : PMM_MAX_ORDER;
+        if (order > PMM_MAX_ORDER) order = PMM_MAX_ORDER;
+        while ((1ULL << order) > count) order--;
+
+        buddy_free_block(node, pfn, order);
+        pfn += 1ULL << order;
+        count -= 1ULL << order;
+    }
+}
+
+static uint32_t order_for_count(size_t count) {
+    uint32_t order = 0;
+    while ((1ULL << order) < count) order++;
+    return order;
+}
+
+// Возвращает в аллокатор только страницы из USABLE-регионов, каждую - в свой узел
+static void release_pages(uint64_t start, uint64_t end) {
+    if (end > pmm_page_count) end = pmm_page_count;
+
+    uint64_t pfn = start;
+    while (pfn < end) {
+        if (pmm_pages[pfn].state != PAGE_STATE_USABLE) {
+            if (pmm_pages[pfn].state & PAGE_STATE_FREE) {
+                serial_puts("[PMM] Double free detected at 0x");
+                char buf[32];
+                serial_puts(itoa(pfn * PAGE_SIZE, buf, 16));
+                serial_puts("\n");
             }
-        } else {
-            consecutive = 0;
+            pfn++;
+            continue;
+        }
+
+        uint8_t id = pmm_pages[pfn].node;
+        uint64_t run = pfn;
+        while (run < end && pmm_pages[run].state == PAGE_STATE_USABLE && pmm_pages[run].node == id) run++;
+
+        struct pmm_node *node = &nodes[id];
+        uint64_t flags = spin_lock_irqsave(&node->lock);
+        buddy_free_range(node, pfn, run - pfn);
+        node->free_pages += run - pfn;
+        spin_unlock_irqrestore(&node->lock, flags);
+        pfn = run;
+    }
+}
+
+static inline uint32_t pcp_slot(struct pmm_pcp *pcp, uint32_t index) {
+    return (pcp->head + index) & (PMM_PCP_SIZE - 1);
+}
+
+static void pcp_refill(struct pmm_pcp *pcp) {
+    struct pmm_node *home = &nodes[local_node()];
+
+    for (uint32_t i = 0; i < home->fallback_count && pcp->count < PMM_PCP_BATCH; i++) {
+        struct pmm_node *node = &nodes[home->fallback[i]];
+        spin_lock(&node->lock);
+        while (pcp->count < PMM_PCP_BATCH) {
+            uint64_t pfn = buddy_alloc_block(node, 0);
+            if (pfn == (uint64_t)-1) break;
+            node->free_pages--;
+            pcp->pages[pcp_slot(pcp, pcp->count)] = pfn;
+            pcp->count++;
+        }
+        spin_unlock(&node->lock);
+    }
+    pcp->stats.refills++;
+}
+
+static void pcp_drain(struct pmm_pcp *pcp, uint32_t batch) {
+    if (batch > pcp->count) batch = pcp->count;
+
+    struct pmm_node *locked = NULL;
+    for (uint32_t i = 0; i < batch; i++) {
+        uint64_t pfn = pcp->pages[pcp->head];
+        struct pmm_node *node = &nodes[pmm_pages[pfn].node];
+        if (node != locked) {
+            if (locked) spin_unlock(&locked->lock);
+            spin_lock(&node->lock);
+            locked = node;
         }
+        buddy_free_block(node, pfn, 0);
+        node->free_pages++;
+        pcp->head = pcp_slot(pcp, 1);
+        pcp->count--;
     }
-    return (uint64_t)-1;
+    if (locked) spin_unlock(&locked->lock);
+    pcp->stats.drains++;
+}
+
+static uint64_t pcp_alloc(void) {
+    uint64_t flags = irq_save();
+    struct pmm_pcp *pcp = &pcp_caches[smp_current_cpu_id()];
+
+    if (pcp->count) {
+        pcp->stats.hits++;
+    } else {
+        pcp->stats.misses++;
+        pcp_refill(pcp);
+        if (!pcp->count) {
+            irq_restore(flags);
+            return 0;
+        }
+    }
+
+    pcp->count--;
+    uint64_t pfn = pcp->pages[pcp_slot(pcp, pcp->count)];
+    irq_restore(flags);
+    return pfn * PAGE_SIZE;
+}
+
+static void pcp_free(uint64_t pfn, bool cold) {
+    uint64_t flags = irq_save();
+    struct pmm_pcp *pcp = &pcp_caches[smp_current_cpu_id()];
+
+    if (pcp->count == PMM_PCP_SIZE) {
+        pcp_drain(pcp, PMM_PCP_BATCH);
+    }
+
+    if (cold) {
+        pcp->head = pcp_slot(pcp, PMM_PCP_SIZE - 1);
+        pcp->pages[pcp->head] = pfn;
+    } else {
+        pcp->pages[pcp_slot(pcp, pcp->count)] = pfn;
+    }
+    pcp->count++;
+    pcp->stats.frees++;
+    irq_restore(flags);
 }
 
 void pmm_init(volatile struct limine_memmap_response *memmap_response,
               volatile struct limine_hhdm_response *hhdm_response) {
     serial_puts("[PMM] Initializing...\n");
-    
+
     current_memmap = memmap_response;
     current_hhdm = hhdm_response;
-    
+
     if (!current_memmap || !current_hhdm) {
         serial_puts("[PMM] ERROR: No memory map or HHDM!\n");
         return;
     }
-    
+
     uint64_t highest_addr = 0;
     uint64_t largest_base = 0;
     uint64_t largest_size = 0;
@@ -83,7 +281,7 @@ void pmm_init(volatile struct limine_memmap_response *memmap_response,
     for (uint64_t i = 0; i < current_memmap->entry_count; i++) {
         struct limine_memmap_entry* entry = current_memmap->entries[i];
         total_memory += entry->length;
-        
+
         if (entry->type == LIMINE_MEMMAP_USABLE) {
             uint64_t end = entry->base + entry->length;
             if (end > highest_addr) highest_addr = end;
@@ -93,86 +291,373 @@ void pmm_init(volatile struct limine_memmap_response *memmap_response,
             }
         }
     }
-    
-    total_pages = highest_addr / PAGE_SIZE;
-    bitmap_size = (total_pages + 7) / 8;
-    
-    bitmap = (uint8_t*)(largest_base + current_hhdm->offset);
-    memset(bitmap, 0, bitmap_size);
+
+    pmm_page_count = highest_addr / PAGE_SIZE;
+    metadata_size = pmm_page_count * sizeof(struct page);
+
+    if (metadata_size > largest_size) {
+        serial_puts("[PMM] ERROR: No region large enough for page metadata!\n");
+        return;
+    }
+
+    pmm_pages = (struct page*)(largest_base + current_hhdm->offset);
+    memset(pmm_pages, 0, metadata_size);
 
     for (uint64_t i = 0; i < current_memmap->entry_count; i++) {
         struct limine_memmap_entry* entry = current_memmap->entries[i];
-        if (entry->type != LIMINE_MEMMAP_USABLE) {
-            uint64_t start = entry->base / PAGE_SIZE;
-            uint64_t end = (entry->base + entry->length + PAGE_SIZE - 1) / PAGE_SIZE;
-            for (uint64_t page = start; page < end; page++) {
-                if (page < total_pages) bitmap_set(page);
+        if (entry->type == LIMINE_MEMMAP_USABLE) {
+            uint64_t start = (entry->base + PAGE_SIZE - 1) / PAGE_SIZE;
+            uint64_t end = (entry->base + entry->length) / PAGE_SIZE;
+            for (uint64_t pfn = start; pfn < end; pfn++) {
+                pmm_pages[pfn].state = PAGE_STATE_USABLE;
             }
         }
     }
-    
-    uint64_t bitmap_start = largest_base / PAGE_SIZE;
-    uint64_t bitmap_end = (largest_base + bitmap_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    for (uint64_t page = bitmap_start; page < bitmap_end; page++) {
-        if (page < total_pages) bitmap_set(page);
+
+    // Страница 0 никогда не выдаётся: 0 означает ошибку выделения
+    pmm_pages[0].state = 0;
+
+    uint64_t meta_start = largest_base / PAGE_SIZE;
+    uint64_t meta_end = (largest_base + metadata_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (uint64_t page = meta_start; page < meta_end; page++) {
+        pmm_pages[page].state = 0;
     }
-    
+
+    // До разбора SRAT вся память принадлежит узлу 0
+    node_count = 1;
+    nodes[0].fallback[0] = 0;
+    nodes[0].fallback_count = 1;
+
+    for (uint64_t i = 0; i < current_memmap->entry_count; i++) {
+        struct limine_memmap_entry* entry = current_memmap->entries[i];
+        if (entry->type == LIMINE_MEMMAP_USABLE) {
+            release_pages(entry->base / PAGE_SIZE,
+                          (entry->base + entry->length) / PAGE_SIZE);
+        }
+    }
+    nodes[0].present_pages = nodes[0].free_pages;
+
     serial_puts("[PMM] Ready: ");
     char buf[32];
-    serial_puts(itoa(total_pages - used_pages, buf, 10));
+    serial_puts(itoa(nodes[0].free_pages, buf, 10));
     serial_puts(" free pages\n");
 }
 
 uint64_t pmm_alloc_page(void) {
-    return pmm_alloc_pages(1);
+    if (!pmm_pages) return 0;
+
+    uint64_t page = pcp_alloc();
+    if (!page) {
+        serial_puts("[PMM] Out of memory!\n");
+    }
+    return page;
+}
+
+static uint64_t alloc_pages_from(uint8_t id, size_t count, uint32_t min_order) {
+    uint32_t order = order_for_count(count);
+    if (order < min_order) order = min_order;
+    if (order > PMM_MAX_ORDER) {
+        serial_puts("[PMM] Allocation too large!\n");
+        return 0;
+    }
+
+    struct pmm_node *home = &nodes[id];
+    for (uint32_t i = 0; i < home->fallback_count; i++) {
+        struct pmm_node *node = &nodes[home->fallback[i]];
+        uint64_t flags = spin_lock_irqsave(&node->lock);
+        uint64_t start = buddy_alloc_block(node, order);
+        if (start == (uint64_t)-1) {
+            spin_unlock_irqrestore(&node->lock, flags);
+            continue;
+        }
+
+        // Хвост блока, превышающий запрос, сразу возвращаем обратно
+        uint64_t block_pages = 1ULL << order;
+        if (block_pages > count) {
+            buddy_free_range(node, start + count, block_pages - count);
+        }
+        node->free_pages -= count;
+        spin_unlock_irqrestore(&node->lock, flags);
+
+        return start * PAGE_SIZE;
+    }
+
+    serial_puts("[PMM] Out of memory!\n");
+    return 0;
 }
 
 uint64_t pmm_alloc_pages(size_t count) {
-    if (!bitmap) return 0;
-    
-    uint64_t start = find_free_pages(count);
-    if (start == (uint64_t)-1) {
-        serial_puts("[PMM] Out of memory!\n");
+    if (!pmm_pages || count == 0) return 0;
+    if (count == 1) return pmm_alloc_page();
+
+    return alloc_pages_from(local_node(), count, 0);
+}
+
+// Блок порядка N всегда выровнен на 2^N страниц, поэтому достаточно поднять порядок
+uint64_t pmm_alloc_pages_aligned(size_t count, uint64_t alignment) {
+    if (!pmm_pages || count == 0) return 0;
+    if (alignment & (alignment - 1)) {
+        serial_puts("[PMM] Alignment must be a power of two\n");
         return 0;
     }
-    
-    for (uint64_t i = 0; i < count; i++) {
-        bitmap_set(start + i);
+
+    uint32_t min_order = 0;
+    while (((uint64_t)PAGE_SIZE << min_order) < alignment) min_order++;
+    if (min_order == 0 && count == 1) return pmm_alloc_page();
+
+    return alloc_pages_from(local_node(), count, min_order);
+}
+
+uint64_t pmm_alloc_pages_node(size_t count, uint8_t node) {
+    if (!pmm_pages || count == 0) return 0;
+    if (node >= node_count) node = 0;
+    if (count == 1 && node == local_node()) return pmm_alloc_page();
+
+    return alloc_pages_from(node, count, 0);
+}
+
+// true - у кадра остались другие владельцы, освобождать его нельзя.
+// Иначе кадр уходит в аллокатор и забывает прежнего владельца
+static bool drop_shared_ref(uint64_t pfn) {
+    if (pfn >= pmm_page_count) return false;
+
+    struct page *page = &pmm_pages[pfn];
+    uint32_t refs = __atomic_load_n(&page->refs, __ATOMIC_RELAXED);
+    while (refs) {
+        if (__atomic_compare_exchange_n(&page->refs, &refs, refs - 1, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return true;
+        }
     }
-    
-    return start * PAGE_SIZE;
+
+    if (page->flags | page->mapping) {
+        page->flags = 0;
+        page->mapping = 0;
+        page->index = 0;
+    }
+    return false;
+}
+
+static void free_single_page(uint64_t page, bool cold) {
+    if (!pmm_pages) return;
+
+    uint64_t pfn = page / PAGE_SIZE;
+    if (drop_shared_ref(pfn)) return;
+    if (pfn < pmm_page_count && pmm_pages[pfn].state == PAGE_STATE_USABLE) {
+        pcp_free(pfn, cold);
+        return;
+    }
+
+    // Чужие или уже свободные страницы - через общий путь с диагностикой
+    release_pages(pfn, pfn + 1);
 }
 
 void pmm_free_page(uint64_t page) {
-    pmm_free_pages(page, 1);
+    free_single_page(page, false);
+}
+
+void pmm_free_page_cold(uint64_t page) {
+    free_single_page(page, true);
 }
 
 void pmm_free_pages(uint64_t page, size_t count) {
-    if (!bitmap) return;
-    
+    if (!pmm_pages) return;
+    if (count == 1) {
+        free_single_page(page, false);
+        return;
+    }
+
+    // Разделяемые фреймы внутри диапазона только теряют ссылку
     uint64_t start = page / PAGE_SIZE;
+    uint64_t end = start + count;
+    uint64_t run = start;
+    for (uint64_t pfn = start; pfn < end; pfn++) {
+        if (!drop_shared_ref(pfn)) continue;
+        if (run < pfn) release_pages(run, pfn);
+        run = pfn + 1;
+    }
+    if (run < end) release_pages(run, end);
+}
+
+bool pmm_share_pages(uint64_t page, size_t count) {
+    if (!pmm_pages) return false;
+
+    uint64_t start = page / PAGE_SIZE;
+    if (start + count > pmm_page_count) return false;
+
     for (uint64_t i = 0; i < count; i++) {
-        if (start + i < total_pages) {
-            bitmap_clear(start + i);
-        }
+        __atomic_fetch_add(&pmm_pages[start + i].refs, 1, __ATOMIC_ACQ_REL);
     }
+    return true;
+}
+
+// Списки хранят pfn вместо указателей: описатель остаётся в 32 байтах
+void page_list_add(struct page_list *list, struct page *page) {
+    uint32_t pfn = (uint32_t)page_to_pfn(page);
+    page->lru_prev = PAGE_PFN_NONE;
+    page->lru_next = list->head;
+    if (list->head != PAGE_PFN_NONE) {
+        pmm_pages[list->head].lru_prev = pfn;
+    } else {
+        list->tail = pfn;
+    }
+    list->head = pfn;
+    list->count++;
+    page->flags |= PAGE_FLAG_LRU;
+}
+
+void page_list_del(struct page_list *list, struct page *page) {
+    if (!(page->flags & PAGE_FLAG_LRU)) return;
+
+    if (page->lru_prev != PAGE_PFN_NONE) {
+        pmm_pages[page->lru_prev].lru_next = page->lru_next;
+    } else {
+        list->head = page->lru_next;
+    }
+    if (page->lru_next != PAGE_PFN_NONE) {
+        pmm_pages[page->lru_next].lru_prev = page->lru_prev;
+    } else {
+        list->tail = page->lru_prev;
+    }
+    page->lru_next = PAGE_PFN_NONE;
+    page->lru_prev = PAGE_PFN_NONE;
+    page->flags &= ~PAGE_FLAG_LRU;
+    list->count--;
+}
+
+void page_list_rotate(struct page_list *list, struct page *page) {
+    if (list->head == page_to_pfn(page)) return;
+    page_list_del(list, page);
+    page_list_add(list, page);
+}
+
+struct page *page_list_pop(struct page_list *list) {
+    if (list->tail == PAGE_PFN_NONE) return NULL;
+
+    struct page *page = &pmm_pages[list->tail];
+    page_list_del(list, page);
+    return page;
+}
+
+static uint64_t pcp_cached_pages(void) {
+    uint64_t cached = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        cached += pcp_caches[i].count;
+    }
+    return cached;
+}
+
+void pmm_pcp_drain(void) {
+    uint64_t flags = irq_save();
+    struct pmm_pcp *pcp = &pcp_caches[smp_current_cpu_id()];
+    pcp_drain(pcp, pcp->count);
+    irq_restore(flags);
+}
+
+bool pmm_get_pcp_stats(uint32_t cpu, struct pmm_pcp_stats *stats) {
+    if (cpu >= MAX_CPUS || !stats) return false;
+    *stats = pcp_caches[cpu].stats;
+    stats->cached = pcp_caches[cpu].count;
+    return true;
 }
 
 uint64_t pmm_get_total_memory(void) {
-    return total_pages * PAGE_SIZE;
+    return pmm_page_count * PAGE_SIZE;
+}
+
+static uint64_t buddy_free_pages(void) {
+    uint64_t free = 0;
+    for (uint32_t i = 0; i < node_count; i++) {
+        free += nodes[i].free_pages;
+    }
+    return free;
 }
 
 uint64_t pmm_get_free_memory(void) {
-    return (total_pages - used_pages) * PAGE_SIZE;
+    return (buddy_free_pages() + pcp_cached_pages() + zero_count) * PAGE_SIZE;
 }
 
 uint64_t pmm_get_used_memory(void) {
-    return used_pages * PAGE_SIZE;
+    return (pmm_page_count - buddy_free_pages() - pcp_cached_pages() - zero_count) * PAGE_SIZE;
+}
+
+uint64_t pmm_get_node_free_memory(uint8_t node) {
+    if (node >= node_count) return 0;
+    return nodes[node].free_pages * PAGE_SIZE;
+}
+
+uint32_t pmm_get_node_count(void) {
+    return node_count;
+}
+
+void pmm_set_node_range(uint64_t base, uint64_t length, uint8_t node) {
+    if (!pmm_pages || node >= PMM_MAX_NODES) return;
+
+    uint64_t start = base / PAGE_SIZE;
+    uint64_t end = (base + length) / PAGE_SIZE;
+    if (end > pmm_page_count) end = pmm_page_count;
+
+    for (uint64_t pfn = start; pfn < end; pfn++) {
+        if (!(pmm_pages[pfn].state & PAGE_STATE_USABLE)) continue;
+        nodes[pmm_pages[pfn].node].present_pages--;
+        nodes[node].present_pages++;
+        pmm_pages[pfn].node = node;
+    }
+
+    if (node >= node_count) node_count = node + 1;
+}
+
+void pmm_set_node_fallback(uint8_t node, const uint8_t *order, uint32_t count) {
+    if (node >= PMM_MAX_NODES) return;
+    if (count > PMM_MAX_NODES) count = PMM_MAX_NODES;
+
+    for (uint32_t i = 0; i < count; i++) {
+        nodes[node].fallback[i] = order[i];
+    }
+    nodes[node].fallback_count = count;
+    if (node >= node_count) node_count = node + 1;
+}
+
+// Перекладывает свободные блоки в списки узлов после разметки page_node
+void pmm_numa_rebalance(void) {
+    if (!pmm_pages) return;
+
+    for (uint32_t i = 0; i < node_count; i++) {
+        if (nodes[i].fallback_count == 0) {
+            nodes[i].fallback[0] = (uint8_t)i;
+            nodes[i].fallback_count = 1;
+        }
+    }
+
+    // Сначала снимаем все блоки: пока блок в pending, он не FREE и не склеится с соседом
+    struct free_block *pending = NULL;
+    for (uint32_t i = 0; i < node_count; i++) {
+        struct pmm_node *node = &nodes[i];
+        uint64_t flags = spin_lock_irqsave(&node->lock);
+        for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+            while (node->free_lists[order]) {
+                struct free_block *block = node->free_lists[order];
+                free_list_remove(node, block_to_pfn(block), order);
+                node->free_pages -= 1ULL << order;
+                block->order = order;
+                block->next = pending;
+                pending = block;
+            }
+        }
+        spin_unlock_irqrestore(&node->lock, flags);
+    }
+
+    while (pending) {
+        struct free_block *next = pending->next;
+        uint64_t pfn = block_to_pfn(pending);
+        release_pages(pfn, pfn + (1ULL << pending->order));
+        pending = next;
+    }
 }
 
 void pmm_dump_memory_map(void) {
     if (!current_memmap) return;
-    
+
     serial_puts("[PMM] Memory Map:\n");
     for (uint64_t i = 0; i < current_memmap->entry_count; i++) {
         struct limine_memmap_entry* entry = current_memmap->entries[i];
@@ -183,4 +668,127 @@ void pmm_dump_memory_map(void) {
         serial_puts(itoa(entry->length / 1024 / 1024, buf, 10));
         serial_puts(" MB\n");
     }
-}
\ No newline at end of file
+}
+
+void pmm_dump_free_lists(void) {
+    char buf[32];
+    for (uint32_t id = 0; id < node_count; id++) {
+        struct pmm_node *node = &nodes[id];
+        serial_puts("[PMM] Node ");
+        serial_puts(itoa(id, buf, 10));
+        serial_puts(" free lists (");
+        serial_puts(itoa(node->free_pages, buf, 10));
+        serial_puts("/");
+        serial_puts(itoa(node->present_pages, buf, 10));
+        serial_puts(" pages free):\n");
+        for (uint32_t order = 0; order <= PMM_MAX_ORDER; order++) {
+            if (!node->free_counts[order]) continue;
+            serial_puts("  Order ");
+            serial_puts(itoa(order, buf, 10));
+            serial_puts(" (");
+            serial_puts(itoa((PAGE_SIZE << order) / 1024, buf, 10));
+            serial_puts(" KB): ");
+            serial_puts(itoa(node->free_counts[order], buf, 10));
+            serial_puts(" blocks\n");
+        }
+    }
+}
+
+void pmm_dump_pcp_stats(void) {
+    serial_puts("[PMM] Per-CPU page caches:\n");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct pmm_pcp_stats *st = &pcp_caches[cpu].stats;
+        if (!st->hits && !st->misses && !st->frees) continue;
+
+        char buf[32];
+        serial_puts("  CPU");
+        serial_puts(itoa(cpu, buf, 10));
+        serial_puts(": hits=");
+        serial_puts(itoa(st->hits, buf, 10));
+        serial_puts(" misses=");
+        serial_puts(itoa(st->misses, buf, 10));
+        serial_puts(" frees=");
+        serial_puts(itoa(st->frees, buf, 10));
+        serial_puts(" refills=");
+        serial_puts(itoa(st->refills, buf, 10));
+        serial_puts(" drains=");
+        serial_puts(itoa(st->drains, buf, 10));
+        serial_puts(" cached=");
+        serial_puts(itoa(pcp_caches[cpu].count, buf, 10));
+        serial_puts("\n");
+    }
+}
+
+// Обнуление мимо кэша: страница не вытесняет рабочие данные idle-CPU
+static void zero_page_nt(uint64_t page) {
+    uint64_t *dst = (uint64_t*)(page + current_hhdm->offset);
+    for (uint64_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 8) {
+        asm volatile(
+            "movnti %1, 0(%0)\n"
+            "movnti %1, 8(%0)\n"
+            "movnti %1, 16(%0)\n"
+            "movnti %1, 24(%0)\n"
+            "movnti %1, 32(%0)\n"
+            "movnti %1, 40(%0)\n"
+            "movnti %1, 48(%0)\n"
+            "movnti %1, 56(%0)\n"
+            :: "r"(&dst[i]), "r"(0ULL) : "memory");
+    }
+}
+
+uint64_t pmm_alloc_zeroed_page(void) {
+    if (!pmm_pages) return 0;
+
+    uint64_t page = 0;
+    uint64_t flags = spin_lock_irqsave(&zero_lock);
+    if (zero_count) {
+        page = zero_pool[--zero_count];
+        zero_stats.hits++;
+    } else {
+        zero_stats.misses++;
+    }
+    spin_unlock_irqrestore(&zero_lock, flags);
+    if (page) return page;
+
+    page = pmm_alloc_page();
+    if (page) {
+        memset((void*)(page + current_hhdm->offset), 0, PAGE_SIZE);
+    }
+    return page;
+}
+
+// Возвращает количество обнулённых страниц; 0 - пул полон или память кончилась
+uint32_t pmm_zero_pool_refill(uint32_t budget) {
+    if (!pmm_pages) return 0;
+
+    uint32_t done = 0;
+    while (done < budget && zero_count < PMM_ZERO_POOL_SIZE) {
+        uint64_t page = pmm_alloc_page();
+        if (!page) break;
+
+        zero_page_nt(page);
+        asm volatile("sfence" ::: "memory");
+
+        uint64_t flags = spin_lock_irqsave(&zero_lock);
+        if (zero_count < PMM_ZERO_POOL_SIZE) {
+            zero_pool[zero_count++] = page;
+            zero_stats.zeroed++;
+            page = 0;
+        }
+        spin_unlock_irqrestore(&zero_lock, flags);
+
+        // Другой CPU успел заполнить пул первым
+        if (page) {
+            pmm_free_page(page);
+            break;
+        }
+        done++;
+    }
+    return done;
+}
+
+void pmm_get_zero_stats(struct pmm_zero_stats *stats) {
+    if (!stats) return;
+    *stats = zero_stats;
+    stats->pooled = zero_count;
+}
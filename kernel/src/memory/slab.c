@@ -0,0 +1,349 @@
+#include "include/memory/slab.h"
+#include "include/memory/pmm.h"
+#include "include/memory/paging.h"
+#include "include/drivers/serial.h"
+#include "libc/string.h"
+
+// Кэш, из которого выделяются сами struct kmem_cache
+static struct kmem_cache cache_cache;
+static struct kmem_cache *kmalloc_caches[KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1];
+
+static struct kmem_cache *cache_list = NULL;
+static spinlock_t cache_list_lock = SPINLOCK_INIT;
+static bool slab_ready = false;
+
+static inline size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline void *slab_first_object(struct kmem_cache *cache, struct kmem_slab *slab) {
+    return (uint8_t*)slab + align_up(sizeof(struct kmem_slab), cache->align);
+}
+
+static inline void **free_link(struct kmem_cache *cache, void *obj) {
+    return (void**)((uint8_t*)obj + cache->free_offset);
+}
+
+static void slab_list_push(struct kmem_slab **list, struct kmem_slab *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+static void slab_list_remove(struct kmem_slab **list, struct kmem_slab *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static struct kmem_slab *slab_create(struct kmem_cache *cache) {
+    uint64_t phys = cache->slab_pages == 1
+        ? pmm_alloc_page()
+        : pmm_alloc_pages_aligned(cache->slab_pages, (uint64_t)cache->slab_pages * PAGE_SIZE);
+    if (!phys) return NULL;
+
+    struct kmem_slab *slab = (struct kmem_slab*)paging_physical_to_virtual(phys);
+    slab->cache = cache;
+    slab->next = slab->prev = NULL;
+    slab->in_use = 0;
+    slab->magic = KMEM_SLAB_MAGIC;
+
+    // Объекты конструируются один раз, при создании slab-а
+    uint8_t *obj = slab_first_object(cache, slab);
+    slab->free_list = NULL;
+    for (uint32_t i = 0; i < cache->objects_per_slab; i++) {
+        void *current = obj + (size_t)(cache->objects_per_slab - 1 - i) * cache->stride;
+        if (cache->ctor) cache->ctor(current);
+        *free_link(cache, current) = slab->free_list;
+        slab->free_list = current;
+    }
+    return slab;
+}
+
+static void slab_release(struct kmem_cache *cache, struct kmem_slab *slab) {
+    slab->magic = 0;
+    uint64_t phys = paging_virtual_to_physical(slab);
+    if (cache->slab_pages == 1) {
+        pmm_free_page(phys);
+    } else {
+        pmm_free_pages(phys, cache->slab_pages);
+    }
+}
+
+static struct kmem_slab *slab_of(struct kmem_cache *cache, const void *obj) {
+    uint64_t slab_size = (uint64_t)cache->slab_pages * PAGE_SIZE;
+    return (struct kmem_slab*)((uint64_t)obj & ~(slab_size - 1));
+}
+
+static bool cache_setup(struct kmem_cache *cache, const char *name, size_t size, size_t align, kmem_ctor_t ctor) {
+    if (size == 0) return false;
+
+    // По умолчанию объект не пересекает границу кэш-линии
+    if (align == 0) {
+        align = 8;
+        while (align < size && align < KMEM_CACHE_LINE) align <<= 1;
+    }
+    if ((align & (align - 1)) || align > PAGE_SIZE) return false;
+
+    memset(cache, 0, sizeof(struct kmem_cache));
+    strncpy(cache->name, name, KMEM_NAME_LEN - 1);
+    cache->object_size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+
+    // С конструктором ссылку нельзя класть поверх объекта - она испортит его состояние
+    size_t stride = align_up(size, sizeof(void*));
+    cache->free_offset = 0;
+    if (ctor) {
+        cache->free_offset = stride;
+        stride += sizeof(void*);
+    }
+    cache->stride = align_up(stride, align);
+
+    cache->slab_pages = 1;
+    for (;;) {
+        size_t header = align_up(sizeof(struct kmem_slab), align);
+        size_t usable = (size_t)cache->slab_pages * PAGE_SIZE - header;
+        cache->objects_per_slab = (uint32_t)(usable / cache->stride);
+        if (cache->objects_per_slab >= KMEM_MIN_OBJECTS || cache->slab_pages >= KMEM_MAX_SLAB_PAGES) break;
+        cache->slab_pages <<= 1;
+    }
+
+    if (cache->objects_per_slab == 0) {
+        serial_puts("[SLAB] Object too large for cache ");
+        serial_puts(name);
+        serial_puts("\n");
+        return false;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&cache_list_lock);
+    cache->next = cache_list;
+    cache_list = cache;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+    return true;
+}
+
+void slab_init(void) {
+    serial_puts("[SLAB] Initializing...\n");
+
+    if (!cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0, NULL)) {
+        serial_puts("[SLAB] ERROR: Failed to bootstrap cache cache!\n");
+        return;
+    }
+
+    for (uint32_t shift = KMALLOC_MIN_SHIFT; shift <= KMALLOC_MAX_SHIFT; shift++) {
+        char name[KMEM_NAME_LEN];
+        char buf[16];
+        strcpy(name, "kmalloc-");
+        strcat(name, itoa(1UL << shift, buf, 10));
+
+        kmalloc_caches[shift - KMALLOC_MIN_SHIFT] = kmem_cache_create(name, 1UL << shift, 0, NULL);
+        if (!kmalloc_caches[shift - KMALLOC_MIN_SHIFT]) {
+            serial_puts("[SLAB] ERROR: Failed to create kmalloc caches!\n");
+            return;
+        }
+    }
+
+    slab_ready = true;
+    serial_puts("[SLAB] Ready\n");
+}
+
+bool slab_is_ready(void) {
+    return slab_ready;
+}
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor) {
+    struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) return NULL;
+
+    if (!cache_setup(cache, name, size, align, ctor)) {
+        kmem_cache_free(&cache_cache, cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void kmem_cache_destroy(struct kmem_cache *cache) {
+    if (!cache || cache == &cache_cache) return;
+
+    if (cache->active_objects) {
+        serial_puts("[SLAB] Cannot destroy cache ");
+        serial_puts(cache->name);
+        serial_puts(": objects still in use\n");
+        return;
+    }
+
+    uint64_t flags = spin_lock_irqsave(&cache_list_lock);
+    struct kmem_cache **link = &cache_list;
+    while (*link && *link != cache) link = &(*link)->next;
+    if (*link) *link = cache->next;
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+
+    kmem_cache_shrink(cache);
+    kmem_cache_free(&cache_cache, cache);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    if (!cache) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    struct kmem_slab *slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab) {
+            slab_list_remove(&cache->empty, slab);
+        } else {
+            // Страницы берём без блокировки кэша
+            spin_unlock_irqrestore(&cache->lock, flags);
+            slab = slab_create(cache);
+            if (!slab) {
+                serial_puts("[SLAB] Out of memory in cache ");
+                serial_puts(cache->name);
+                serial_puts("\n");
+                return NULL;
+            }
+            flags = spin_lock_irqsave(&cache->lock);
+            cache->slab_count++;
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+
+    void *obj = slab->free_list;
+    slab->free_list = *free_link(cache, obj);
+    slab->in_use++;
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+
+    cache->active_objects++;
+    cache->total_allocs++;
+    spin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+    if (!cache || !obj) return;
+
+    struct kmem_slab *slab = slab_of(cache, obj);
+    uint8_t *first = slab_first_object(cache, slab);
+    if (slab->magic != KMEM_SLAB_MAGIC || slab->cache != cache ||
+        (uint8_t*)obj < first || ((uint8_t*)obj - first) % cache->stride) {
+        serial_puts("[SLAB] Invalid free in cache ");
+        serial_puts(cache->name);
+        serial_puts(" at 0x");
+        char buf[32];
+        serial_puts(itoa((uint64_t)obj, buf, 16));
+        serial_puts("\n");
+        return;
+    }
+
+    struct kmem_slab *release = NULL;
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+
+    if (slab->in_use == cache->objects_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+
+    *free_link(cache, obj) = slab->free_list;
+    slab->free_list = obj;
+    slab->in_use--;
+    cache->active_objects--;
+    cache->total_frees++;
+
+    // Один пустой slab держим про запас, остальные возвращаем в PMM
+    if (slab->in_use == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty) {
+            release = slab;
+            cache->slab_count--;
+        } else {
+            slab_list_push(&cache->empty, slab);
+        }
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    if (release) slab_release(cache, release);
+}
+
+void kmem_cache_shrink(struct kmem_cache *cache) {
+    if (!cache) return;
+
+    uint64_t flags = spin_lock_irqsave(&cache->lock);
+    struct kmem_slab *list = cache->empty;
+    cache->empty = NULL;
+    for (struct kmem_slab *slab = list; slab; slab = slab->next) {
+        cache->slab_count--;
+    }
+    spin_unlock_irqrestore(&cache->lock, flags);
+
+    while (list) {
+        struct kmem_slab *next = list->next;
+        slab_release(cache, list);
+        list = next;
+    }
+}
+
+static struct kmem_cache *kmalloc_cache_for(size_t size) {
+    uint32_t shift = KMALLOC_MIN_SHIFT;
+    while ((1UL << shift) < size) shift++;
+    return kmalloc_caches[shift - KMALLOC_MIN_SHIFT];
+}
+
+void *kmem_alloc_small(size_t size) {
+    if (!slab_ready || size == 0 || size > KMALLOC_SLAB_MAX) return NULL;
+    return kmem_cache_alloc(kmalloc_cache_for(size));
+}
+
+// kmalloc-кэши используют slab-ы в одну страницу, заголовок находится по адресу страницы
+static struct kmem_cache *kmalloc_cache_of(const void *ptr) {
+    struct kmem_slab *slab = (struct kmem_slab*)((uint64_t)ptr & ~((uint64_t)PAGE_SIZE - 1));
+    if (!slab_ready || slab->magic != KMEM_SLAB_MAGIC) return NULL;
+
+    for (uint32_t i = 0; i <= KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT; i++) {
+        if (kmalloc_caches[i] == slab->cache) return slab->cache;
+    }
+    return NULL;
+}
+
+bool kmem_free_small(void *ptr) {
+    struct kmem_cache *cache = kmalloc_cache_of(ptr);
+    if (!cache) return false;
+
+    kmem_cache_free(cache, ptr);
+    return true;
+}
+
+size_t kmem_object_size(const void *ptr) {
+    struct kmem_cache *cache = kmalloc_cache_of(ptr);
+    return cache ? cache->object_size : 0;
+}
+
+void kmem_dump_caches(void) {
+    serial_puts("[SLAB] Caches:\n");
+
+    uint64_t flags = spin_lock_irqsave(&cache_list_lock);
+    for (struct kmem_cache *cache = cache_list; cache; cache = cache->next) {
+        char buf[32];
+        serial_puts("  ");
+        serial_puts(cache->name);
+        serial_puts(": size=");
+        serial_puts(itoa(cache->object_size, buf, 10));
+        serial_puts(" stride=");
+        serial_puts(itoa(cache->stride, buf, 10));
+        serial_puts(" active=");
+        serial_puts(itoa(cache->active_objects, buf, 10));
+        serial_puts(" slabs=");
+        serial_puts(itoa(cache->slab_count, buf, 10));
+        serial_puts(" x");
+        serial_puts(itoa(cache->slab_pages, buf, 10));
+        serial_puts(" pages\n");
+    }
+    spin_unlock_irqrestore(&cache_list_lock, flags);
+}
@@ -0,0 +1,333 @@
+#include "include/memory/tlb.h"
+#include "include/memory/pmm.h"
+#include "include/memory/paging.h"
+#include "include/sys/smp.h"
+#include "include/sys/apic.h"
+#include "include/sys/spinlock.h"
+#include "include/interrupts/idt.h"
+#include "include/drivers/serial.h"
+#include "libc/string.h"
+
+#define TLB_CONTEXT_BUCKETS 64
+
+struct tlb_range {
+    uint64_t start;
+    uint64_t size;
+};
+
+struct tlb_cpu {
+    spinlock_t lock;
+    volatile uint32_t pending;     // IPI уже отправлен и ещё не обработан
+    uint32_t count;
+    bool flush_all;
+    struct tlb_range ranges[TLB_QUEUE_SIZE];
+    volatile uint64_t requested;
+    volatile uint64_t completed;
+    volatile uint64_t active_cr3;  // 0 - CR3 от загрузчика, совпадает с любым пространством
+    uint64_t pcid_generation;      // поколение PCID, до которого этот CPU сбросил TLB
+    struct tlb_stats stats;
+} __attribute__((aligned(64)));
+
+static struct tlb_cpu tlb_cpus[MAX_CPUS];
+
+// PCID раздаются по возрастанию; когда кончаются, начинается новое поколение,
+// и каждый CPU перед первым входом в пространство нового поколения сбрасывает всё
+static spinlock_t context_lock = SPINLOCK_INIT;
+static struct tlb_context *contexts[TLB_CONTEXT_BUCKETS];
+static uint64_t pcid_generation = 1;
+static uint32_t pcid_next = 1;
+
+void tlb_init(void) {
+#ifndef DEER_HOSTED
+    isr_install_handler(TLB_SHOOTDOWN_VECTOR, tlb_shootdown_handler);
+#endif
+    serial_puts("[TLB] Shootdown vector installed\n");
+}
+
+void tlb_set_active(uint64_t cr3) {
+    tlb_cpus[smp_current_cpu_id()].active_cr3 = cr3 & PAGING_ADDR_MASK;
+}
+
+// Забирает очередь своего CPU и выполняет сбросы. wait=false - из опроса
+// в spin_lock: если очередь сейчас заполняет другой CPU, вернёмся позже
+static void tlb_process(bool wait) {
+    struct tlb_cpu *cpu = &tlb_cpus[smp_current_cpu_id()];
+    if (!cpu->pending) return;
+
+    struct tlb_range ranges[TLB_QUEUE_SIZE];
+    uint64_t irq = irq_save();
+    if (wait) {
+        spin_lock(&cpu->lock);
+    } else if (!spin_trylock(&cpu->lock)) {
+        irq_restore(irq);
+        return;
+    }
+
+    uint32_t count = cpu->count;
+    bool flush_all = cpu->flush_all;
+    uint64_t generation = cpu->requested;
+    memcpy(ranges, cpu->ranges, count * sizeof(struct tlb_range));
+    cpu->count = 0;
+    cpu->flush_all = false;
+    cpu->pending = 0;
+    spin_unlock(&cpu->lock);
+
+    if (flush_all) {
+        paging_flush_tlb();
+        cpu->stats.full_flushes++;
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            paging_invalidate_tlb_range(ranges[i].start, ranges[i].size);
+        }
+        cpu->stats.ranges_flushed += count;
+    }
+    cpu->stats.ipis_received++;
+
+    __atomic_store_n(&cpu->completed, generation, __ATOMIC_RELEASE);
+    irq_restore(irq);
+}
+
+void tlb_poll(void) {
+    tlb_process(false);
+}
+
+void tlb_shootdown_handler(struct registers *regs) {
+    (void)regs;
+    tlb_process(true);
+#ifndef DEER_HOSTED
+    lapic_eoi();
+#endif
+}
+
+static inline uint32_t context_bucket(uint64_t pml4_phys) {
+    return (pml4_phys >> 12) % TLB_CONTEXT_BUCKETS;
+}
+
+void tlb_context_init(struct tlb_context *ctx, uint64_t pml4_phys) {
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->pml4_phys = pml4_phys & PAGING_ADDR_MASK;
+
+    uint64_t irq = spin_lock_irqsave(&context_lock);
+    uint32_t bucket = context_bucket(ctx->pml4_phys);
+    ctx->next = contexts[bucket];
+    contexts[bucket] = ctx;
+    spin_unlock_irqrestore(&context_lock, irq);
+}
+
+// PCID не освобождается: он вернётся в оборот со следующим поколением
+void tlb_context_destroy(struct tlb_context *ctx) {
+    uint64_t irq = spin_lock_irqsave(&context_lock);
+    struct tlb_context **link = &contexts[context_bucket(ctx->pml4_phys)];
+    while (*link && *link != ctx) link = &(*link)->next;
+    if (*link) *link = ctx->next;
+    spin_unlock_irqrestore(&context_lock, irq);
+}
+
+static struct tlb_context *context_lookup(uint64_t pml4_phys) {
+    uint64_t irq = spin_lock_irqsave(&context_lock);
+    struct tlb_context *ctx = contexts[context_bucket(pml4_phys)];
+    while (ctx && ctx->pml4_phys != pml4_phys) ctx = ctx->next;
+    spin_unlock_irqrestore(&context_lock, irq);
+    return ctx;
+}
+
+// Вызывается с выключенными прерываниями прямо перед записью CR3
+uint64_t tlb_context_switch(struct tlb_context *ctx) {
+    uint32_t self = smp_current_cpu_id();
+    struct tlb_cpu *cpu = &tlb_cpus[self];
+
+    if (!paging_pcid_enabled()) {
+        cpu->active_cr3 = ctx->pml4_phys;
+        return ctx->pml4_phys;
+    }
+
+    spin_lock(&context_lock);
+    if (ctx->generation != pcid_generation) {
+        if (pcid_next == TLB_PCID_COUNT) {
+            pcid_generation++;
+            pcid_next = 1;
+        }
+        ctx->pcid = (uint16_t)pcid_next++;
+        ctx->generation = pcid_generation;
+        for (uint32_t i = 0; i < MAX_CPUS / 64; i++) ctx->cpu_mask[i] = 0;
+    }
+    uint64_t generation = pcid_generation;
+    uint64_t cr3 = ctx->pml4_phys | ctx->pcid;
+    spin_unlock(&context_lock);
+
+    bool flushed = false;
+    if (cpu->pcid_generation != generation) {
+        // Те же номера PCID могли принадлежать пространствам прошлого поколения
+        paging_flush_tlb();
+        cpu->pcid_generation = generation;
+        flushed = true;
+    }
+
+    // Сначала объявляем пространство активным, потом смотрим бит: shootdown
+    // делает наоборот, так что хотя бы один из нас увидит другого
+    cpu->active_cr3 = ctx->pml4_phys;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint64_t bit = 1ULL << (self % 64);
+    uint64_t old = __atomic_fetch_or(&ctx->cpu_mask[self / 64], bit, __ATOMIC_SEQ_CST);
+
+    if ((old & bit) || flushed) {
+        cpu->stats.pcid_hits++;
+        return cr3 | TLB_CR3_NOFLUSH;
+    }
+    cpu->stats.pcid_flushes++;
+    return cr3;
+}
+
+static bool tlb_is_target(uint32_t id, uint32_t self, uint64_t pml4_phys, uint64_t virtual_addr,
+                          struct tlb_context *ctx) {
+    if (smp_state.cpus[id].state != CPU_STATE_RUNNING && id != self) return false;
+    if (virtual_addr >= PAGING_KERNEL_HALF) return id != self;
+
+    uint64_t active = tlb_cpus[id].active_cr3;
+    bool is_active = !active || active == pml4_phys;
+    if (ctx && !(id == self && is_active)) {
+        // Неактивному CPU хватит сброса PCID при следующем входе в пространство
+        uint64_t bit = 1ULL << (id % 64);
+        uint64_t old = __atomic_fetch_and(&ctx->cpu_mask[id / 64], ~bit, __ATOMIC_SEQ_CST);
+        active = tlb_cpus[id].active_cr3;
+        is_active = !active || active == pml4_phys;
+        if ((old & bit) && !is_active) tlb_cpus[self].stats.lazy_flushes++;
+    }
+    return id != self && is_active;
+}
+
+// Ставит диапазон в очередь CPU; IPI нужен, только если его там ещё нет
+static bool tlb_queue(struct tlb_cpu *cpu, uint64_t virtual_addr, uint64_t size) {
+    spin_lock(&cpu->lock);
+    if (cpu->flush_all || cpu->count == TLB_QUEUE_SIZE) {
+        cpu->flush_all = true;
+    } else {
+        cpu->ranges[cpu->count].start = virtual_addr;
+        cpu->ranges[cpu->count].size = size;
+        cpu->count++;
+    }
+    cpu->requested++;
+    bool send = !cpu->pending;
+    cpu->pending = 1;
+    spin_unlock(&cpu->lock);
+    return send;
+}
+
+// Сбрасывает диапазон локально и на всех CPU, где он может быть закэширован.
+// Возвращает управление, когда все адресаты подтвердили сброс
+void tlb_shootdown(page_table_t* pml4, uint64_t virtual_addr, uint64_t size) {
+    paging_invalidate_tlb_range(virtual_addr, size);
+
+    uint32_t self = smp_current_cpu_id();
+    uint32_t cpu_count = smp_state.cpu_count < MAX_CPUS ? smp_state.cpu_count : MAX_CPUS;
+    uint64_t pml4_phys = paging_virtual_to_physical(pml4);
+    struct tlb_context *ctx = virtual_addr < PAGING_KERNEL_HALF ? context_lookup(pml4_phys) : NULL;
+    uint64_t targets[MAX_CPUS / 64] = {0};
+    bool any = false;
+
+    for (uint32_t id = 0; id < cpu_count; id++) {
+        if (!tlb_is_target(id, self, pml4_phys, virtual_addr, ctx)) continue;
+
+        targets[id / 64] |= 1ULL << (id % 64);
+        any = true;
+        if (tlb_queue(&tlb_cpus[id], virtual_addr, size)) {
+#ifndef DEER_HOSTED
+            smp_send_ipi(smp_state.cpus[id].lapic_id, TLB_SHOOTDOWN_VECTOR);
+#endif
+            tlb_cpus[self].stats.ipis_sent++;
+        }
+    }
+    if (!any) return;
+    tlb_cpus[self].stats.shootdowns++;
+
+    for (uint32_t id = 0; id < cpu_count; id++) {
+        if (!(targets[id / 64] & (1ULL << (id % 64)))) continue;
+
+        struct tlb_cpu *cpu = &tlb_cpus[id];
+        uint64_t generation = cpu->requested;
+        // Пока ждём, обслуживаем свою очередь: адресат может ждать нас
+        while (__atomic_load_n(&cpu->completed, __ATOMIC_ACQUIRE) < generation) {
+            tlb_poll();
+            asm volatile("pause");
+        }
+    }
+}
+
+void tlb_gather_init(struct tlb_gather *gather, page_table_t* pml4) {
+    gather->pml4 = pml4;
+    gather->start = 0;
+    gather->end = 0;
+    gather->freed_pages = 0;
+    gather->frame_count = 0;
+}
+
+void tlb_gather_add(struct tlb_gather *gather, uint64_t virtual_addr, uint64_t size, uint64_t phys) {
+    if (gather->start == gather->end) {
+        gather->start = virtual_addr;
+        gather->end = virtual_addr + size;
+    } else {
+        if (virtual_addr < gather->start) gather->start = virtual_addr;
+        if (virtual_addr + size > gather->end) gather->end = virtual_addr + size;
+    }
+
+    // Кадры устройств (phys == 0) в PMM не возвращаются, нужен только сброс
+    if (!phys) return;
+
+    struct tlb_gather_frame *last = gather->frame_count ? &gather->frames[gather->frame_count - 1] : NULL;
+    uint64_t pages = size / PAGE_SIZE;
+    if (last && last->phys + last->pages * PAGE_SIZE == phys) {
+        last->pages += pages;
+    } else {
+        gather->frames[gather->frame_count].phys = phys;
+        gather->frames[gather->frame_count].pages = pages;
+        gather->frame_count++;
+    }
+}
+
+void tlb_gather_flush(struct tlb_gather *gather) {
+    if (gather->start == gather->end) return;
+
+    tlb_shootdown(gather->pml4, gather->start, gather->end - gather->start);
+    for (uint32_t i = 0; i < gather->frame_count; i++) {
+        pmm_free_pages(gather->frames[i].phys, gather->frames[i].pages);
+        gather->freed_pages += gather->frames[i].pages;
+    }
+    gather->start = 0;
+    gather->end = 0;
+    gather->frame_count = 0;
+}
+
+bool tlb_get_stats(uint32_t cpu, struct tlb_stats *stats) {
+    if (cpu >= MAX_CPUS || !stats) return false;
+    *stats = tlb_cpus[cpu].stats;
+    return true;
+}
+
+void tlb_dump_stats(void) {
+    serial_puts("[TLB] Shootdown statistics:\n");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct tlb_stats *st = &tlb_cpus[cpu].stats;
+        if (!st->shootdowns && !st->ipis_received && !st->pcid_hits && !st->pcid_flushes) continue;
+
+        char buf[32];
+        serial_puts("  CPU");
+        serial_puts(itoa(cpu, buf, 10));
+        serial_puts(": shootdowns=");
+        serial_puts(itoa(st->shootdowns, buf, 10));
+        serial_puts(" ipis_sent=");
+        serial_puts(itoa(st->ipis_sent, buf, 10));
+        serial_puts(" received=");
+        serial_puts(itoa(st->ipis_received, buf, 10));
+        serial_puts(" full_flushes=");
+        serial_puts(itoa(st->full_flushes, buf, 10));
+        serial_puts(" ranges=");
+        serial_puts(itoa(st->ranges_flushed, buf, 10));
+        serial_puts(" pcid_hits=");
+        serial_puts(itoa(st->pcid_hits, buf, 10));
+        serial_puts(" pcid_flushes=");
+        serial_puts(itoa(st->pcid_flushes, buf, 10));
+        serial_puts(" lazy=");
+        serial_puts(itoa(st->lazy_flushes, buf, 10));
+        serial_puts("\n");
+    }
+}
@@ -0,0 +1,156 @@
+#include "include/memory/vma.h"
+
+static inline int32_t node_height(struct vma *node) {
+    return node ? node->height : 0;
+}
+
+static void update_height(struct vma *node) {
+    int32_t left = node_height(node->left);
+    int32_t right = node_height(node->right);
+    node->height = (left > right ? left : right) + 1;
+}
+
+static struct vma *rotate_right(struct vma *node) {
+    struct vma *pivot = node->left;
+    node->left = pivot->right;
+    pivot->right = node;
+    update_height(node);
+    update_height(pivot);
+    return pivot;
+}
+
+static struct vma *rotate_left(struct vma *node) {
+    struct vma *pivot = node->right;
+    node->right = pivot->left;
+    pivot->left = node;
+    update_height(node);
+    update_height(pivot);
+    return pivot;
+}
+
+static struct vma *balance(struct vma *node) {
+    update_height(node);
+    int32_t factor = node_height(node->left) - node_height(node->right);
+
+    if (factor > 1) {
+        if (node_height(node->left->left) < node_height(node->left->right)) {
+            node->left = rotate_left(node->left);
+        }
+        return rotate_right(node);
+    }
+    if (factor < -1) {
+        if (node_height(node->right->right) < node_height(node->right->left)) {
+            node->right = rotate_right(node->right);
+        }
+        return rotate_left(node);
+    }
+    return node;
+}
+
+static struct vma *insert_node(struct vma *node, struct vma *vma) {
+    if (!node) return vma;
+
+    if (vma->start < node->start) {
+        node->left = insert_node(node->left, vma);
+    } else {
+        node->right = insert_node(node->right, vma);
+    }
+    return balance(node);
+}
+
+static struct vma *remove_min(struct vma *node, struct vma **min) {
+    if (!node->left) {
+        *min = node;
+        return node->right;
+    }
+    node->left = remove_min(node->left, min);
+    return balance(node);
+}
+
+static struct vma *remove_node(struct vma *node, struct vma *vma) {
+    if (!node) return NULL;
+
+    if (vma->start < node->start) {
+        node->left = remove_node(node->left, vma);
+    } else if (vma->start > node->start) {
+        node->right = remove_node(node->right, vma);
+    } else {
+        struct vma *left = node->left;
+        struct vma *right = node->right;
+        if (!right) return left;
+
+        // Место узла занимает его преемник
+        struct vma *min;
+        right = remove_min(right, &min);
+        min->left = left;
+        min->right = right;
+        return balance(min);
+    }
+    return balance(node);
+}
+
+void vma_tree_init(struct vma_tree *tree) {
+    tree->root = NULL;
+    tree->last_hit = NULL;
+    tree->count = 0;
+    tree->lookups = 0;
+    tree->cache_hits = 0;
+}
+
+bool vma_tree_insert(struct vma_tree *tree, struct vma *vma) {
+    if (vma->start >= vma->end) return false;
+
+    struct vma *next = vma_tree_next(tree, vma->start);
+    if (next && next->start < vma->end) return false;
+
+    vma->left = NULL;
+    vma->right = NULL;
+    vma->height = 1;
+    tree->root = insert_node(tree->root, vma);
+    tree->count++;
+    return true;
+}
+
+void vma_tree_remove(struct vma_tree *tree, struct vma *vma) {
+    tree->root = remove_node(tree->root, vma);
+    if (tree->last_hit == vma) tree->last_hit = NULL;
+    tree->count--;
+}
+
+struct vma *vma_tree_find(struct vma_tree *tree, uint64_t addr) {
+    tree->lookups++;
+
+    struct vma *hit = tree->last_hit;
+    if (hit && addr >= hit->start && addr < hit->end) {
+        tree->cache_hits++;
+        return hit;
+    }
+
+    struct vma *node = tree->root;
+    while (node) {
+        if (addr < node->start) {
+            node = node->left;
+        } else if (addr >= node->end) {
+            node = node->right;
+        } else {
+            tree->last_hit = node;
+            return node;
+        }
+    }
+    return NULL;
+}
+
+struct vma *vma_tree_next(struct vma_tree *tree, uint64_t addr) {
+    // Области не пересекаются, поэтому порядок по end совпадает с порядком по start
+    struct vma *best = NULL;
+    struct vma *node = tree->root;
+    while (node) {
+        if (node->end > addr) {
+            best = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return best;
+}
@@ -0,0 +1,195 @@
+#include "include/memory/vmalloc.h"
+#include "include/memory/paging.h"
+#include "include/memory/pmm.h"
+#include "include/memory/slab.h"
+#include "include/sys/spinlock.h"
+#include "include/drivers/serial.h"
+#include "libc/string.h"
+
+// Резервы отсортированы по адресу, свободные промежутки между ними ищем first-fit
+static struct vm_area *areas = NULL;
+static struct kmem_cache *area_cache = NULL;
+static spinlock_t vmalloc_lock = SPINLOCK_INIT;
+
+static inline uint64_t align_up(uint64_t value, uint64_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+void vmalloc_init(void) {
+    serial_puts("[VMALLOC] Initializing...\n");
+
+    area_cache = kmem_cache_create("vm_area", sizeof(struct vm_area), 0, NULL);
+    if (!area_cache) {
+        serial_puts("[VMALLOC] ERROR: Failed to create area cache!\n");
+        return;
+    }
+
+    serial_puts("[VMALLOC] Ready at 0xFFFFFFFFA0000000 (256 MB)\n");
+}
+
+// Ищет промежуток, в котором поместится size байт с addr, выровненным на align
+static bool reserve_range(struct vm_area *area, uint64_t length, uint64_t align) {
+    uint64_t cursor = VMALLOC_START;
+    struct vm_area **link = &areas;
+
+    for (;;) {
+        uint64_t limit = *link ? (*link)->start : VMALLOC_END;
+        uint64_t addr = align_up(cursor + VMALLOC_GUARD_SIZE, align);
+        uint64_t end = addr + length + VMALLOC_GUARD_SIZE;
+
+        if (end <= limit) {
+            area->start = addr - VMALLOC_GUARD_SIZE;
+            area->size = end - area->start;
+            area->addr = addr;
+            area->length = length;
+            area->next = *link;
+            *link = area;
+            return true;
+        }
+
+        if (!*link) return false;
+        cursor = (*link)->start + (*link)->size;
+        link = &(*link)->next;
+    }
+}
+
+static void unreserve_range(struct vm_area *area) {
+    struct vm_area **link = &areas;
+    while (*link && *link != area) link = &(*link)->next;
+    if (*link) *link = area->next;
+}
+
+static void unmap_area(uint64_t addr, uint64_t length) {
+    if (length) paging_unmap_range(addr, length);
+}
+
+static bool map_area(struct vm_area *area) {
+    uint64_t flags = PAGING_PRESENT | PAGING_WRITABLE | PAGING_NO_EXECUTE;
+
+    for (uint64_t offset = 0; offset < area->length; ) {
+        uint64_t virtual_addr = area->addr + offset;
+
+        if ((area->flags & VMALLOC_LARGE) && area->length - offset >= PAGE_SIZE_2M &&
+            !(virtual_addr & (PAGE_SIZE_2M - 1))) {
+            uint64_t physical = pmm_alloc_pages_aligned(PAGE_SIZE_2M / PAGE_SIZE_4K, PAGE_SIZE_2M);
+            if (physical) {
+                if (area->flags & VMALLOC_ZERO) {
+                    memset(paging_physical_to_virtual(physical), 0, PAGE_SIZE_2M);
+                }
+                if (paging_map_large_page(virtual_addr, physical, PAGE_SIZE_2M, flags)) {
+                    offset += PAGE_SIZE_2M;
+                    continue;
+                }
+                pmm_free_pages(physical, PAGE_SIZE_2M / PAGE_SIZE_4K);
+            }
+        }
+
+        uint64_t physical = (area->flags & VMALLOC_ZERO) ? pmm_alloc_zeroed_page() : pmm_alloc_page();
+        if (!physical) {
+            unmap_area(area->addr, offset);
+            return false;
+        }
+        if (!paging_map_page(virtual_addr, physical, flags)) {
+            pmm_free_page(physical);
+            unmap_area(area->addr, offset);
+            return false;
+        }
+        offset += PAGE_SIZE_4K;
+    }
+    return true;
+}
+
+void* vmalloc_flags(size_t size, uint32_t flags) {
+    if (size == 0 || !area_cache) return NULL;
+
+    struct vm_area *area = kmem_cache_alloc(area_cache);
+    if (!area) return NULL;
+    area->flags = flags;
+
+    uint64_t length = align_up(size, PAGE_SIZE_4K);
+    uint64_t align = PAGE_SIZE_4K;
+    if ((flags & VMALLOC_LARGE) && length >= PAGE_SIZE_2M) {
+        align = PAGE_SIZE_2M;
+    }
+
+    uint64_t irq = spin_lock_irqsave(&vmalloc_lock);
+    bool reserved = reserve_range(area, length, align);
+    spin_unlock_irqrestore(&vmalloc_lock, irq);
+
+    if (!reserved) {
+        serial_puts("[VMALLOC] Out of virtual space\n");
+        kmem_cache_free(area_cache, area);
+        return NULL;
+    }
+
+    // Страницы отображаем вне блокировки: резерв уже принадлежит нам
+    if (!map_area(area)) {
+        serial_puts("[VMALLOC] Out of physical memory\n");
+        irq = spin_lock_irqsave(&vmalloc_lock);
+        unreserve_range(area);
+        spin_unlock_irqrestore(&vmalloc_lock, irq);
+        kmem_cache_free(area_cache, area);
+        return NULL;
+    }
+
+    return (void*)area->addr;
+}
+
+void* vmalloc(size_t size) {
+    return vmalloc_flags(size, 0);
+}
+
+void vfree(void* ptr) {
+    if (!ptr) return;
+
+    uint64_t irq = spin_lock_irqsave(&vmalloc_lock);
+    struct vm_area *area = areas;
+    while (area && area->addr != (uint64_t)ptr) area = area->next;
+    if (area) unreserve_range(area);
+    spin_unlock_irqrestore(&vmalloc_lock, irq);
+
+    if (!area) {
+        serial_puts("[VMALLOC] Invalid vfree at 0x");
+        char buf[32];
+        serial_puts(itoa((uint64_t)ptr, buf, 16));
+        serial_puts("\n");
+        return;
+    }
+
+    unmap_area(area->addr, area->length);
+    kmem_cache_free(area_cache, area);
+}
+
+bool vmalloc_is_guard(uint64_t addr) {
+    if (addr < VMALLOC_START || addr >= VMALLOC_END) return false;
+
+    bool guard = false;
+    uint64_t irq = spin_lock_irqsave(&vmalloc_lock);
+    for (struct vm_area *area = areas; area; area = area->next) {
+        if (addr >= area->start && addr < area->start + area->size) {
+            guard = addr < area->addr || addr >= area->addr + area->length;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&vmalloc_lock, irq);
+    return guard;
+}
+
+void vmalloc_dump(void) {
+    serial_puts("[VMALLOC] Areas:\n");
+
+    uint64_t irq = spin_lock_irqsave(&vmalloc_lock);
+    for (struct vm_area *area = areas; area; area = area->next) {
+        char buf[32];
+        serial_puts("  0x");
+        serial_puts(itoa(area->addr, buf, 16));
+        serial_puts(" - 0x");
+        serial_puts(itoa(area->addr + area->length, buf, 16));
+        serial_puts(" (");
+        serial_puts(itoa(area->length / 1024, buf, 10));
+        serial_puts(" KB)");
+        if (area->flags & VMALLOC_LARGE) serial_puts(" large");
+        serial_puts("\n");
+    }
+    spin_unlock_irqrestore(&vmalloc_lock, irq);
+}
@@ -1,6 +1,9 @@
 #include "include/memory/vmm.h"
 #include "include/memory/heap.h"
 #include "include/memory/pmm.h"
+#include "include/memory/page.h"
+#include "include/memory/slab.h"
+#include "include/sys/spinlock.h"
 #include "include/drivers/serial.h"
 #include "libc/string.h"
 #include "libc/stdio.h"
@@ -8,6 +11,15 @@
 
 static vmm_space_t kernel_space = {0};
 static uint64_t hhdm_offset = 0;
+static struct kmem_cache *space_cache = NULL;
+static struct kmem_cache *area_cache = NULL;
+static vmm_space_t *current_space[MAX_CPUS];
+
+// Область кучи ядра: куча работает раньше slab, узел статический
+static struct vma heap_area;
+
+#define PF_WRITE 0x2
+#define PF_USER  0x4
 
 void vmm_init(volatile struct limine_hhdm_response *hhdm_response) {
     serial_puts("[VMM] Initializing...\n");
@@ -19,18 +31,30 @@ void vmm_init(volatile struct limine_hhdm_response *hhdm_response) {
     
     hhdm_offset = hhdm_response->offset;
     
-    uint64_t cr3 = paging_get_cr3();
+    uint64_t cr3 = paging_get_cr3() & PAGING_ADDR_MASK;
     kernel_space.pml4 = (page_table_t*)(cr3 + hhdm_offset);
     kernel_space.hhdm_offset = hhdm_offset;
+    tlb_context_init(&kernel_space.tlb, cr3);
+    vma_tree_init(&kernel_space.areas);
+
+    space_cache = kmem_cache_create("vmm_space", sizeof(vmm_space_t), 0, NULL);
+    area_cache = kmem_cache_create("vma", sizeof(struct vma), 0, NULL);
+
+    heap_area.start = HEAP_START;
+    heap_area.end = HEAP_START + HEAP_MAX_SIZE;
+    heap_area.flags = PAGING_PRESENT | PAGING_WRITABLE;
+    heap_area.type = VMA_ANON;
+    vma_tree_insert(&kernel_space.areas, &heap_area);
     
     serial_puts("[VMM] Ready\n");
 }
 
 vmm_space_t* vmm_create_space(void) {
-    uint64_t pml4_phys = pmm_alloc_page();
+    uint64_t pml4_phys = pmm_alloc_zeroed_page();
     if (!pml4_phys) return NULL;
+    page_set_owner(phys_to_page(pml4_phys), PAGE_FLAG_TABLE, 0, 0);
     
-    vmm_space_t* space = (vmm_space_t*)kmalloc(sizeof(vmm_space_t));
+    vmm_space_t* space = (vmm_space_t*)kmem_cache_alloc(space_cache);
     if (!space) {
         pmm_free_page(pml4_phys);
         return NULL;
@@ -38,94 +62,159 @@ vmm_space_t* vmm_create_space(void) {
     
     space->pml4 = (page_table_t*)(pml4_phys + hhdm_offset);
     space->hhdm_offset = hhdm_offset;
-    
-    memset(space->pml4, 0, PAGE_SIZE_4K);
+    tlb_context_init(&space->tlb, pml4_phys);
+    vma_tree_init(&space->areas);
+    space->area_lock = (spinlock_t)SPINLOCK_INIT;
     
     vmm_map_kernel(space);
     
     return space;
 }
 
+static bool clone_areas(vmm_space_t *dst, vmm_space_t *src) {
+    for (struct vma* vma = vma_tree_next(&src->areas, 0); vma; vma = vma_tree_next(&src->areas, vma->end)) {
+        struct vma* copy = (struct vma*)kmem_cache_alloc(area_cache);
+        if (!copy) return false;
+        *copy = *vma;
+        vma_tree_insert(&dst->areas, copy);
+    }
+    return true;
+}
+
+vmm_space_t* vmm_clone_space(vmm_space_t *src) {
+    // Промах по куче во время копирования берёт area_lock пространства ядра
+    if (!src || src == &kernel_space) return NULL;
+
+    vmm_space_t* space = vmm_create_space();
+    if (!space) return NULL;
+
+    uint64_t irq = spin_lock_irqsave(&src->area_lock);
+    bool copied = clone_areas(space, src);
+    spin_unlock_irqrestore(&src->area_lock, irq);
+
+    if (!copied || !paging_clone_user_in(space->pml4, src->pml4)) {
+        serial_puts("[VMM] ERROR: Out of memory cloning address space\n");
+        vmm_destroy_space(space);
+        return NULL;
+    }
+    return space;
+}
+
+// Кадры устройств принадлежат не PMM
+static void free_leaf(page_table_entry_t entry, uint64_t page_size) {
+    if (entry & PAGING_MMIO) return;
+    pmm_free_pages(entry & PAGING_ADDR_MASK & ~(page_size - 1), page_size / PAGE_SIZE_4K);
+}
+
 void vmm_destroy_space(vmm_space_t *space) {
     if (!space) return;
+    tlb_context_destroy(&space->tlb);
+
+    while (space->areas.root) {
+        struct vma* vma = space->areas.root;
+        vma_tree_remove(&space->areas, vma);
+        kmem_cache_free(area_cache, vma);
+    }
     
     for (uint64_t i = 0; i < 256; i++) {
         if (space->pml4->entries[i] & PAGING_PRESENT) {
-            page_table_t* pdp = (page_table_t*)((space->pml4->entries[i] & ~0xFFF) + hhdm_offset);
+            page_table_t* pdp = (page_table_t*)((space->pml4->entries[i] & PAGING_ADDR_MASK) + hhdm_offset);
             for (uint64_t j = 0; j < 512; j++) {
-                if (pdp->entries[j] & PAGING_PRESENT) {
-                    page_table_t* pd = (page_table_t*)((pdp->entries[j] & ~0xFFF) + hhdm_offset);
-                    for (uint64_t k = 0; k < 512; k++) {
-                        if (pd->entries[k] & PAGING_PRESENT) {
-                            page_table_t* pt = (page_table_t*)((pd->entries[k] & ~0xFFF) + hhdm_offset);
-                            for (uint64_t l = 0; l < 512; l++) {
-                                if (pt->entries[l] & PAGING_PRESENT) {
-                                    pmm_free_page(pt->entries[l] & ~0xFFF);
-                                }
-                            }
-                            pmm_free_page(pd->entries[k] & ~0xFFF);
+                if (!(pdp->entries[j] & PAGING_PRESENT)) continue;
+                if (pdp->entries[j] & PAGING_HUGE_PAGE) {
+                    free_leaf(pdp->entries[j], PAGE_SIZE_1G);
+                    continue;
+                }
+
+                page_table_t* pd = (page_table_t*)((pdp->entries[j] & PAGING_ADDR_MASK) + hhdm_offset);
+                for (uint64_t k = 0; k < 512; k++) {
+                    if (!(pd->entries[k] & PAGING_PRESENT)) continue;
+                    if (pd->entries[k] & PAGING_HUGE_PAGE) {
+                        free_leaf(pd->entries[k], PAGE_SIZE_2M);
+                        continue;
+                    }
+
+                    page_table_t* pt = (page_table_t*)((pd->entries[k] & PAGING_ADDR_MASK) + hhdm_offset);
+                    for (uint64_t l = 0; l < 512; l++) {
+                        if (pt->entries[l] & PAGING_PRESENT) {
+                            free_leaf(pt->entries[l], PAGE_SIZE_4K);
                         }
                     }
-                    pmm_free_page(pdp->entries[j] & ~0xFFF);
+                    pmm_free_page(pd->entries[k] & PAGING_ADDR_MASK);
                 }
+                pmm_free_page(pdp->entries[j] & PAGING_ADDR_MASK);
             }
-            pmm_free_page(space->pml4->entries[i] & ~0xFFF);
+            pmm_free_page(space->pml4->entries[i] & PAGING_ADDR_MASK);
         }
     }
     
     pmm_free_page((uint64_t)space->pml4 - hhdm_offset);
-    kfree(space);
+    kmem_cache_free(space_cache, space);
 }
 
 void vmm_switch_space(vmm_space_t *space) {
     if (!space) return;
-    uint64_t phys = (uint64_t)space->pml4 - hhdm_offset;
-    paging_load_cr3(phys);
+    // С PCID записи прежнего пространства остаются в TLB до следующего входа
+    uint64_t irq = irq_save();
+    paging_load_cr3(tlb_context_switch(&space->tlb));
+    current_space[smp_current_cpu_id()] = space;
+    irq_restore(irq);
+}
+
+vmm_space_t* vmm_current_space(void) {
+    vmm_space_t* space = current_space[smp_current_cpu_id()];
+    return space ? space : &kernel_space;
 }
 
 bool vmm_map_page(vmm_space_t *space, uint64_t virtual_addr, uint64_t physical_addr, uint64_t flags) {
     if (!space) return false;
-    
-    uint64_t pml4_index = (virtual_addr >> 39) & 0x1FF;
-    uint64_t pdp_index = (virtual_addr >> 30) & 0x1FF;
-    uint64_t pd_index = (virtual_addr >> 21) & 0x1FF;
-    uint64_t pt_index = (virtual_addr >> 12) & 0x1FF;
-    
-    page_table_t* pdp;
-    if (!(space->pml4->entries[pml4_index] & PAGING_PRESENT)) {
-        uint64_t pdp_phys = pmm_alloc_page();
-        if (!pdp_phys) return false;
-        pdp = (page_table_t*)(pdp_phys + hhdm_offset);
-        memset(pdp, 0, PAGE_SIZE_4K);
-        space->pml4->entries[pml4_index] = pdp_phys | PAGING_PRESENT | PAGING_WRITABLE | (flags & PAGING_USER ? PAGING_USER : 0);
-    } else {
-        pdp = (page_table_t*)((space->pml4->entries[pml4_index] & ~0xFFF) + hhdm_offset);
-    }
-    
-    page_table_t* pd;
-    if (!(pdp->entries[pdp_index] & PAGING_PRESENT)) {
-        uint64_t pd_phys = pmm_alloc_page();
-        if (!pd_phys) return false;
-        pd = (page_table_t*)(pd_phys + hhdm_offset);
-        memset(pd, 0, PAGE_SIZE_4K);
-        pdp->entries[pdp_index] = pd_phys | PAGING_PRESENT | PAGING_WRITABLE | (flags & PAGING_USER ? PAGING_USER : 0);
-    } else {
-        pd = (page_table_t*)((pdp->entries[pdp_index] & ~0xFFF) + hhdm_offset);
-    }
-    
-    page_table_t* pt;
-    if (!(pd->entries[pd_index] & PAGING_PRESENT)) {
-        uint64_t pt_phys = pmm_alloc_page();
-        if (!pt_phys) return false;
-        pt = (page_table_t*)(pt_phys + hhdm_offset);
-        memset(pt, 0, PAGE_SIZE_4K);
-        pd->entries[pd_index] = pt_phys | PAGING_PRESENT | PAGING_WRITABLE | (flags & PAGING_USER ? PAGING_USER : 0);
-    } else {
-        pt = (page_table_t*)((pd->entries[pd_index] & ~0xFFF) + hhdm_offset);
-    }
-    
-    pt->entries[pt_index] = physical_addr | flags | PAGING_PRESENT;
-    return true;
+    return paging_map_in(space->pml4, virtual_addr, physical_addr, PAGE_SIZE_4K, flags);
+}
+
+bool vmm_map_large_page(vmm_space_t *space, uint64_t virtual_addr, uint64_t physical_addr,
+                        uint64_t page_size, uint64_t flags) {
+    if (!space) return false;
+    return paging_map_in(space->pml4, virtual_addr, physical_addr, page_size, flags);
+}
+
+bool vmm_unmap_page(vmm_space_t *space, uint64_t virtual_addr) {
+    if (!space) return false;
+    return paging_unmap_in(space->pml4, virtual_addr);
+}
+
+bool vmm_map_range(vmm_space_t *space, uint64_t virtual_addr, uint64_t physical_addr,
+                   uint64_t size, uint64_t flags) {
+    if (!space) return false;
+    return paging_map_range_in(space->pml4, virtual_addr, physical_addr, size, flags);
+}
+
+uint64_t vmm_unmap_range(vmm_space_t *space, uint64_t virtual_addr, uint64_t size) {
+    if (!space) return 0;
+    return paging_unmap_range_in(space->pml4, virtual_addr, size);
+}
+
+bool vmm_is_mapped(vmm_space_t *space, uint64_t virtual_addr) {
+    if (!space) return false;
+    return paging_lookup_in(space->pml4, virtual_addr, NULL) != NULL;
+}
+
+uint64_t vmm_get_physical(vmm_space_t *space, uint64_t virtual_addr) {
+    if (!space) return 0;
+
+    uint64_t page_size = 0;
+    page_table_entry_t* entry = paging_lookup_in(space->pml4, virtual_addr, &page_size);
+    if (!entry) return 0;
+
+    uint64_t base = *entry & PAGING_ADDR_MASK & ~(page_size - 1);
+    return base | (virtual_addr & (page_size - 1));
+}
+
+uint64_t vmm_get_page_size(vmm_space_t *space, uint64_t virtual_addr) {
+    if (!space) return 0;
+
+    uint64_t page_size = 0;
+    if (!paging_lookup_in(space->pml4, virtual_addr, &page_size)) return 0;
+    return page_size;
 }
 
 bool vmm_map_kernel(vmm_space_t *space) {
@@ -133,4 +222,180 @@ bool vmm_map_kernel(vmm_space_t *space) {
         space->pml4->entries[i] = kernel_space.pml4->entries[i];
     }
     return true;
-}
\ No newline at end of file
+}
+
+void vmm_dump_mappings(vmm_space_t *space) {
+    if (!space) return;
+
+    char buf[32];
+    uint64_t counts[3] = {0};
+    for (uint64_t i = 0; i < 256; i++) {
+        if (!(space->pml4->entries[i] & PAGING_PRESENT)) continue;
+        page_table_t* pdp = (page_table_t*)((space->pml4->entries[i] & PAGING_ADDR_MASK) + hhdm_offset);
+        for (uint64_t j = 0; j < 512; j++) {
+            if (!(pdp->entries[j] & PAGING_PRESENT)) continue;
+            if (pdp->entries[j] & PAGING_HUGE_PAGE) { counts[2]++; continue; }
+            page_table_t* pd = (page_table_t*)((pdp->entries[j] & PAGING_ADDR_MASK) + hhdm_offset);
+            for (uint64_t k = 0; k < 512; k++) {
+                if (!(pd->entries[k] & PAGING_PRESENT)) continue;
+                if (pd->entries[k] & PAGING_HUGE_PAGE) { counts[1]++; continue; }
+                page_table_t* pt = (page_table_t*)((pd->entries[k] & PAGING_ADDR_MASK) + hhdm_offset);
+                for (uint64_t l = 0; l < 512; l++) {
+                    if (pt->entries[l] & PAGING_PRESENT) counts[0]++;
+                }
+            }
+        }
+    }
+
+    serial_puts("[VMM] User mappings: ");
+    serial_puts(itoa(counts[0], buf, 10));
+    serial_puts(" x 4K, ");
+    serial_puts(itoa(counts[1], buf, 10));
+    serial_puts(" x 2M, ");
+    serial_puts(itoa(counts[2], buf, 10));
+    serial_puts(" x 1G, ");
+    serial_puts(itoa(space->areas.count, buf, 10));
+    serial_puts(" areas\n");
+}
+
+static struct vma* new_area(uint64_t virtual_addr, uint64_t size, uint64_t flags, enum vma_type type) {
+    if (!size || ((virtual_addr | size) & (PAGE_SIZE_4K - 1))) {
+        serial_puts("[VMM] ERROR: Unaligned area\n");
+        return NULL;
+    }
+
+    struct vma* vma = (struct vma*)kmem_cache_alloc(area_cache);
+    if (!vma) return NULL;
+
+    vma->start = virtual_addr;
+    vma->end = virtual_addr + size;
+    vma->flags = flags | PAGING_PRESENT;
+    vma->type = type;
+    return vma;
+}
+
+static bool insert_area(vmm_space_t *space, struct vma *vma) {
+    uint64_t irq = spin_lock_irqsave(&space->area_lock);
+    bool inserted = vma_tree_insert(&space->areas, vma);
+    spin_unlock_irqrestore(&space->area_lock, irq);
+
+    if (!inserted) {
+        serial_puts("[VMM] ERROR: Area overlaps an existing one\n");
+        kmem_cache_free(area_cache, vma);
+    }
+    return inserted;
+}
+
+bool vmm_map_anon(vmm_space_t *space, uint64_t virtual_addr, uint64_t size, uint64_t flags) {
+    if (!space) return false;
+    struct vma* vma = new_area(virtual_addr, size, flags, VMA_ANON);
+    return vma && insert_area(space, vma);
+}
+
+bool vmm_map_file(vmm_space_t *space, uint64_t virtual_addr, uint64_t size, uint64_t flags,
+                  const struct vma_file *file, uint64_t offset) {
+    if (!space || !file || !file->read_page) return false;
+    struct vma* vma = new_area(virtual_addr, size, flags, VMA_FILE);
+    if (!vma) return false;
+
+    vma->file.file = file;
+    vma->file.offset = offset;
+    return insert_area(space, vma);
+}
+
+bool vmm_map_stack(vmm_space_t *space, uint64_t top, uint64_t max_size, uint64_t flags) {
+    if (!space || max_size <= PAGE_SIZE_4K || max_size > top) return false;
+    struct vma* vma = new_area(top - max_size, max_size, flags, VMA_STACK);
+    if (!vma) return false;
+
+    vma->stack_low = top;
+    return insert_area(space, vma);
+}
+
+bool vmm_map_device(vmm_space_t *space, uint64_t virtual_addr, uint64_t physical_addr,
+                    uint64_t size, uint64_t flags) {
+    if (!space || (physical_addr & (PAGE_SIZE_4K - 1))) return false;
+    struct vma* vma = new_area(virtual_addr, size, flags | PAGING_MMIO, VMA_DEVICE);
+    if (!vma) return false;
+
+    vma->phys = physical_addr;
+    return insert_area(space, vma);
+}
+
+bool vmm_unmap_area(vmm_space_t *space, uint64_t virtual_addr) {
+    if (!space) return false;
+
+    uint64_t irq = spin_lock_irqsave(&space->area_lock);
+    struct vma* vma = vma_tree_find(&space->areas, virtual_addr);
+    if (vma && vma != &heap_area) vma_tree_remove(&space->areas, vma);
+    spin_unlock_irqrestore(&space->area_lock, irq);
+
+    if (!vma || vma == &heap_area) return false;
+
+    paging_unmap_range_in(space->pml4, vma->start, vma->end - vma->start);
+    kmem_cache_free(area_cache, vma);
+    return true;
+}
+
+// Проверка прав и рост стека; вызывается под area_lock
+static bool area_allows(struct vma *vma, uint64_t page, uint64_t error_code) {
+    if ((error_code & PF_WRITE) && !(vma->flags & PAGING_WRITABLE)) return false;
+    if ((error_code & PF_USER) && !(vma->flags & PAGING_USER)) return false;
+    if (vma->type != VMA_STACK) return true;
+
+    // Нижняя страница - защитная, а обращение далеко под стеком - не рост, а ошибка
+    if (page < vma->start + PAGE_SIZE_4K) return false;
+    if (page + VMA_STACK_GAP < vma->stack_low) return false;
+    if (page < vma->stack_low) vma->stack_low = page;
+    return true;
+}
+
+static bool fault_in(vmm_space_t *space, const struct vma *area, uint64_t page) {
+    uint64_t offset = page - area->start;
+
+    if (area->type == VMA_DEVICE) {
+        return paging_map_absent_in(space->pml4, page, area->phys + offset, area->flags) ||
+               paging_lookup_in(space->pml4, page, NULL);
+    }
+
+    uint64_t phys;
+    if (area->type == VMA_FILE) {
+        phys = pmm_alloc_page();
+        if (phys && !area->file.file->read_page(area->file.file->ctx, area->file.offset + offset,
+                                                (void*)(phys + hhdm_offset))) {
+            serial_puts("[VMM] ERROR: File read failed during page fault\n");
+            pmm_free_page(phys);
+            return false;
+        }
+    } else {
+        phys = pmm_alloc_zeroed_page();
+    }
+    if (!phys) return false;
+
+    if (area->type == VMA_FILE) {
+        page_set_owner(phys_to_page(phys), PAGE_FLAG_FILE, (uint64_t)area->file.file, area->file.offset + offset);
+    } else {
+        page_set_owner(phys_to_page(phys), PAGE_FLAG_ANON, (uint64_t)space, page);
+    }
+
+    if (paging_map_absent_in(space->pml4, page, phys, area->flags)) return true;
+
+    // Страницу уже отобразил другой CPU
+    pmm_free_page(phys);
+    return paging_lookup_in(space->pml4, page, NULL) != NULL;
+}
+
+bool vmm_handle_fault(uint64_t fault_address, uint64_t error_code) {
+    vmm_space_t* space = fault_address >= PAGING_KERNEL_HALF ? &kernel_space : vmm_current_space();
+    uint64_t page = fault_address & ~(uint64_t)(PAGE_SIZE_4K - 1);
+
+    // Область копируется: страницу заполняем уже без блокировки
+    struct vma area;
+    uint64_t irq = spin_lock_irqsave(&space->area_lock);
+    struct vma* vma = vma_tree_find(&space->areas, fault_address);
+    bool allowed = vma && area_allows(vma, page, error_code);
+    if (allowed) area = *vma;
+    spin_unlock_irqrestore(&space->area_lock, irq);
+
+    return allowed && fault_in(space, &area, page);
+}
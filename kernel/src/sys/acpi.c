@@ -10,29 +10,51 @@
 extern volatile struct limine_rsdp_request rsdp_request; 
 struct acpi_state acpi_state = {0};
 
-static void* acpi_map_physical_to_virtual(uint64_t physical_addr) {
+// Limine отображает в HHDM не всю ACPI-память: добавляем недостающие страницы
+// [physical_addr, physical_addr + length) непрерывными диапазонами
+static void* acpi_map_physical_to_virtual(uint64_t physical_addr, size_t length) {
     if (physical_addr == 0) {
         return NULL;
     }
     void* virtual_addr = paging_physical_to_virtual(physical_addr);
 
-    uint64_t page_virtual = (uint64_t)virtual_addr & ~0xFFF;
     uint64_t page_physical = physical_addr & ~0xFFF;
+    uint64_t end_physical = (physical_addr + length + 0xFFF) & ~0xFFFULL;
+    uint64_t flags = PAGING_PRESENT | PAGING_WRITABLE | PAGING_NO_EXECUTE;
 
-    if (!paging_is_mapped(page_virtual)) {
-        uint64_t flags = PAGING_PRESENT | PAGING_WRITABLE | PAGING_NO_EXECUTE;
-        if (!paging_map_page(page_virtual, page_physical, flags)) {
+    while (page_physical < end_physical) {
+        if (paging_is_mapped((uint64_t)paging_physical_to_virtual(page_physical))) {
+            page_physical += 0x1000;
+            continue;
+        }
+
+        uint64_t run_end = page_physical + 0x1000;
+        while (run_end < end_physical && !paging_is_mapped((uint64_t)paging_physical_to_virtual(run_end))) {
+            run_end += 0x1000;
+        }
+
+        if (!paging_map_range((uint64_t)paging_physical_to_virtual(page_physical), page_physical,
+                              run_end - page_physical, flags)) {
             serial_puts("[ACPI] ERROR: Failed to map page for physical address 0x");
             char hex_buf[17];
-            serial_puts(itoa(physical_addr, hex_buf, 16));
+            serial_puts(itoa(page_physical, hex_buf, 16));
             serial_putc('\n');
             return NULL;
         }
-    } 
+        page_physical = run_end;
+    }
 
     return virtual_addr;
 }
 
+// Сначала заголовок, затем таблица целиком по его длине
+static struct acpi_sdt_header* acpi_map_table(uint64_t physical_addr) {
+    struct acpi_sdt_header* header =
+        acpi_map_physical_to_virtual(physical_addr, sizeof(struct acpi_sdt_header));
+    if (!header) return NULL;
+    return acpi_map_physical_to_virtual(physical_addr, header->length);
+}
+
 void acpi_init(volatile struct limine_hhdm_response *hhdm_response) {
     serial_puts("[ACPI] Initializing ACPI...");
 
@@ -59,7 +81,7 @@ void acpi_init(volatile struct limine_hhdm_response *hhdm_response) {
     serial_puts(itoa(rsdp_phys_addr, hex_buf, 16));
     serial_putc('\n');
 
-    void* rsdp_virt_ptr = acpi_map_physical_to_virtual(rsdp_phys_addr);
+    void* rsdp_virt_ptr = acpi_map_physical_to_virtual(rsdp_phys_addr, sizeof(struct acpi_rsdp));
 
     serial_puts("[ACPI] Calculated RSDP virtual address: ");
     serial_puts(itoa((uint64_t)rsdp_virt_ptr, hex_buf, 16));
@@ -97,7 +119,7 @@ void acpi_init(volatile struct limine_hhdm_response *hhdm_response) {
     serial_puts("[ACPI] RSDP checksum valid");
 
     if (acpi_state.rsdp->revision >= 2 && acpi_state.rsdp->xsdt_address != 0) {
-        acpi_state.xsdt = (struct acpi_xsdt*)acpi_map_physical_to_virtual(acpi_state.rsdp->xsdt_address);
+        acpi_state.xsdt = (struct acpi_xsdt*)acpi_map_table(acpi_state.rsdp->xsdt_address);
         if (acpi_state.xsdt) {
             serial_puts("[ACPI] XSDT found and mapped");
             acpi_state.use_xsdt = 1;
@@ -105,7 +127,7 @@ void acpi_init(volatile struct limine_hhdm_response *hhdm_response) {
             serial_puts("[ACPI] WARNING: XSDT address invalid, falling back to RSDT");
         }
     } else {
-        acpi_state.rsdt = (struct acpi_rsdt*)acpi_map_physical_to_virtual(acpi_state.rsdp->rsdt_address);
+        acpi_state.rsdt = (struct acpi_rsdt*)acpi_map_table(acpi_state.rsdp->rsdt_address);
         if (acpi_state.rsdt) {
             serial_puts("[ACPI] RSDT found and mapped");
             acpi_state.use_xsdt = 0;
@@ -153,6 +175,18 @@ void acpi_init(volatile struct limine_hhdm_response *hhdm_response) {
         serial_puts("[ACPI] ACPI not available\n");
     }
 
+    acpi_state.srat = (struct acpi_srat*)acpi_find_table(ACPI_SRAT_SIGNATURE, hhdm_response);
+    if (acpi_state.srat) {
+        serial_puts("[ACPI] SRAT found\n");
+    } else {
+        serial_puts("[ACPI] SRAT not found (single NUMA node)\n");
+    }
+
+    acpi_state.slit = (struct acpi_slit*)acpi_find_table(ACPI_SLIT_SIGNATURE, hhdm_response);
+    if (acpi_state.slit) {
+        serial_puts("[ACPI] SLIT found\n");
+    }
+
     serial_puts("[ACPI] ACPI initialized successfully\n");
 }
 
@@ -168,7 +202,7 @@ struct acpi_sdt_header *acpi_find_table(const char* signature, volatile struct l
         uint64_t entry_count = (acpi_state.xsdt->header.length - sizeof(struct acpi_sdt_header)) / 8;
 
         for (uint64_t i = 0; i < entry_count; i++) {
-            table_header = (struct acpi_sdt_header*)acpi_map_physical_to_virtual(acpi_state.xsdt->tables[i]);
+            table_header = acpi_map_table(acpi_state.xsdt->tables[i]);
             if (!table_header) continue;
 
             if (strncmp(table_header->signature, signature, 4) == 0 && acpi_checksum_valid(table_header, table_header->length)) {
@@ -182,7 +216,7 @@ struct acpi_sdt_header *acpi_find_table(const char* signature, volatile struct l
         uint32_t entry_count = (acpi_state.rsdt->header.length - sizeof(struct acpi_sdt_header)) / 4;
 
         for (uint32_t i = 0; i < entry_count; i++) {
-            table_header = (struct acpi_sdt_header*)acpi_map_physical_to_virtual(acpi_state.rsdt->tables[i]);
+            table_header = acpi_map_table(acpi_state.rsdt->tables[i]);
             if (!table_header) continue;
 
             if (strncmp(table_header->signature, signature, 4) == 0 && acpi_checksum_valid(table_header, table_header->length)) {
@@ -8,16 +8,20 @@
 #include "libc/stdio.h"
 #include "libc/string.h"
 #include "include/memory/paging.h"
+#include "include/memory/ioremap.h"
 #include "include/tasking/task.h"
+#include "include/sys/smp.h"
+#include "include/sys/tick.h"
 
 // Макрос для чтения из MMIO APIC
 #define APIC_READ(reg) (*(volatile uint32_t*)(apic_state.lapic_base + (reg)))
 // Макрос для записи в MMIO APIC
 #define APIC_WRITE(reg, val) (*(volatile uint32_t*)(apic_state.lapic_base + (reg)) = (val))
 
-// Определения регистров ICR
-#define APIC_ICR1 0x310
-#define APIC_ICR2 0x300
+// Определения регистров ICR: младшее слово (команда) по 0x300,
+// старшее (назначение) по 0x310
+#define APIC_ICR1 0x300
+#define APIC_ICR2 0x310
 #define APIC_ICR_DELIVERY_MODE_SHIFT 8
 #define APIC_ICR_DEST_MODE_SHIFT 11
 #define APIC_ICR_LEVEL_SHIFT 14
@@ -41,18 +45,23 @@ struct apic_state apic_state = {0};
 volatile uint64_t lapic_ticks = 0; 
 
 uint64_t lapic_get_ticks(void) {
+    // Без периодического тика миллисекунды берутся из часов
+    if (tick_nohz_active()) return tick_now_ns() / 1000000;
     return lapic_ticks;
 }
 
 void lapic_timer_handler(struct registers *regs) {
     (void)regs;
-    lapic_ticks++;
-
-    // Вызываем планировщик каждые 10 тиков (~10 мс)
-    if (lapic_ticks % 10 == 0) {
-        extern void task_scheduler_tick(void);
-        task_scheduler_tick();
+    if (tick_nohz_active()) {
+        tick_interrupt();
+        return;
     }
+
+    // Таймер есть у каждого CPU, время считает только BSP
+    if (smp_get_current_cpu()->is_bsp) lapic_ticks++;
+
+    // Кванты считает планировщик (task_set_timeslice)
+    task_scheduler_tick();
 }
 
 static volatile bool lapic_sleeping = false;
@@ -60,6 +69,10 @@ static volatile uint64_t sleep_end_ticks = 0;
 
 void lapic_sleep_ms(uint64_t ms) {
     if (!apic_state.apic_available) return;
+    if (tick_nohz_active()) {
+        tick_sleep_ns(ms * 1000000);
+        return;
+    }
 
     uint64_t current_ticks = lapic_get_ticks();
     uint64_t target_ticks = current_ticks + ms;
@@ -77,6 +90,10 @@ void lapic_sleep_ms(uint64_t ms) {
 }
 
 void lapic_sleep_us(uint64_t us) {
+    if (tick_nohz_active()) {
+        tick_sleep_ns(us * 1000);
+        return;
+    }
     uint64_t ms = (us + 999) / 1000; 
     lapic_sleep_ms(ms);
 }
@@ -153,13 +170,7 @@ void lapic_init(volatile struct limine_hhdm_response *hhdm_response) {
     serial_puts(itoa(lapic_page_aligned_virt, buffer, 16));
     serial_puts("\n");
 
-    #ifdef PAGING_NO_EXECUTE
-        #define LAPIC_PAGING_FLAGS (PAGING_PRESENT | PAGING_WRITABLE | PAGING_NO_EXECUTE)
-    #else
-        #define LAPIC_PAGING_FLAGS (PAGING_PRESENT | PAGING_WRITABLE)
-    #endif
-
-    if (!paging_map_page(lapic_page_aligned_virt, lapic_page_aligned_phys, LAPIC_PAGING_FLAGS)) {
+    if (!ioremap(lapic_page_aligned_phys, PAGE_SIZE_4K, IOREMAP_UC)) {
         serial_puts("[APIC] ERROR: Failed to map LAPIC physical page to virtual memory!\n");
         apic_state.apic_available = false;
         return;
@@ -219,8 +230,8 @@ void ioapic_init(volatile struct limine_hhdm_response *hhdm_response) {
             struct madt_ioapic* ioapic = (struct madt_ioapic*)header;
 
             if (hhdm_response) {
-                apic_state.ioapic_base = (struct ioapic_regs*)((uint64_t)ioapic->ioapic_addr + hhdm_response->offset);
-                apic_state.ioapic_available = true;
+                apic_state.ioapic_base = (struct ioapic_regs*)ioremap(ioapic->ioapic_addr, sizeof(struct ioapic_regs), IOREMAP_UC);
+                apic_state.ioapic_available = apic_state.ioapic_base != NULL;
 
                 serial_puts("[APIC] Found IOAPIC at physical: 0x");
                 char buffer[32];
@@ -266,7 +277,8 @@ void hpet_init(volatile struct limine_hhdm_response *hhdm_response) {
     }
 
     if (hhdm_response) {
-        apic_state.hpet_base = (struct hpet_regs*)((uint64_t)acpi_state.hpet->base_address.address + hhdm_response->offset);
+        apic_state.hpet_base = (struct hpet_regs*)ioremap(acpi_state.hpet->base_address.address, PAGE_SIZE_4K, IOREMAP_UC);
+        if (!apic_state.hpet_base) return;
 
         serial_puts("[HPET] HPET at physical: 0x");
         char buffer[32];
@@ -404,7 +416,7 @@ void lapic_timer_init(uint8_t vector, uint32_t frequency) {
 
 void lapic_timer_stop(void) {
     if (!apic_state.apic_available) return;
-    lapic_write(LAPIC_LVT_TIMER, 0x10000); 
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_MASKED); 
 }
 
 void apic_init(volatile struct limine_hhdm_response *hhdm_response) {
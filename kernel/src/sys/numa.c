@@ -0,0 +1,202 @@
+#include "include/sys/numa.h"
+#include "include/sys/acpi.h"
+#include "include/sys/smp.h"
+#include "include/memory/pmm.h"
+#include "include/drivers/serial.h"
+#include "libc/string.h"
+
+struct numa_state numa_state = {0};
+
+// Proximity domain из SRAT может быть произвольным 32-битным числом, узлы нумеруем плотно
+static int numa_node_for_domain(uint32_t domain, bool create) {
+    for (uint32_t i = 0; i < numa_state.node_count; i++) {
+        if (numa_state.proximity_domain[i] == domain) return (int)i;
+    }
+
+    if (!create) return -1;
+    if (numa_state.node_count >= PMM_MAX_NODES) {
+        serial_puts("[NUMA] WARNING: Too many proximity domains, folding into node 0\n");
+        return 0;
+    }
+
+    numa_state.proximity_domain[numa_state.node_count] = domain;
+    return (int)numa_state.node_count++;
+}
+
+static void numa_add_cpu(uint32_t apic_id, uint32_t domain) {
+    if (numa_state.cpu_count >= MAX_CPUS) return;
+
+    int node = numa_node_for_domain(domain, true);
+    numa_state.cpu_apic_id[numa_state.cpu_count] = apic_id;
+    numa_state.cpu_node[numa_state.cpu_count] = (uint8_t)node;
+    numa_state.cpu_count++;
+}
+
+static void numa_add_memory(uint64_t base, uint64_t length, uint32_t domain) {
+    if (numa_state.range_count >= NUMA_MAX_RANGES) {
+        serial_puts("[NUMA] WARNING: Too many memory ranges in SRAT\n");
+        return;
+    }
+
+    int node = numa_node_for_domain(domain, true);
+    struct numa_memory_range *range = &numa_state.ranges[numa_state.range_count++];
+    range->base = base;
+    range->length = length;
+    range->node = (uint8_t)node;
+}
+
+static void numa_parse_srat(struct acpi_srat *srat) {
+    uint8_t *ptr = (uint8_t*)srat + sizeof(struct acpi_srat);
+    uint8_t *end = (uint8_t*)srat + srat->header.length;
+
+    while (ptr + sizeof(struct srat_entry_header) <= end) {
+        struct srat_entry_header *header = (struct srat_entry_header*)ptr;
+        if (header->length == 0) break;
+
+        switch (header->type) {
+            case SRAT_ENTRY_CPU_AFFINITY: {
+                struct srat_cpu_affinity *cpu = (struct srat_cpu_affinity*)header;
+                if (!(cpu->flags & SRAT_FLAG_ENABLED)) break;
+                uint32_t domain = cpu->proximity_domain_low |
+                                  ((uint32_t)cpu->proximity_domain_high[0] << 8) |
+                                  ((uint32_t)cpu->proximity_domain_high[1] << 16) |
+                                  ((uint32_t)cpu->proximity_domain_high[2] << 24);
+                numa_add_cpu(cpu->apic_id, domain);
+                break;
+            }
+            case SRAT_ENTRY_X2APIC_AFFINITY: {
+                struct srat_x2apic_affinity *cpu = (struct srat_x2apic_affinity*)header;
+                if (!(cpu->flags & SRAT_FLAG_ENABLED)) break;
+                numa_add_cpu(cpu->x2apic_id, cpu->proximity_domain);
+                break;
+            }
+            case SRAT_ENTRY_MEMORY_AFFINITY: {
+                struct srat_memory_affinity *mem = (struct srat_memory_affinity*)header;
+                if (!(mem->flags & SRAT_FLAG_ENABLED) || mem->length == 0) break;
+                numa_add_memory(mem->base_address, mem->length, mem->proximity_domain);
+                break;
+            }
+            default:
+                break;
+        }
+
+        ptr += header->length;
+    }
+}
+
+static void numa_parse_slit(struct acpi_slit *slit) {
+    for (uint32_t from = 0; from < numa_state.node_count; from++) {
+        for (uint32_t to = 0; to < numa_state.node_count; to++) {
+            uint64_t a = numa_state.proximity_domain[from];
+            uint64_t b = numa_state.proximity_domain[to];
+            if (a >= slit->locality_count || b >= slit->locality_count) continue;
+            numa_state.distance[from][to] = slit->entries[a * slit->locality_count + b];
+        }
+    }
+}
+
+// Для каждого узла: сначала он сам, затем остальные по возрастанию расстояния
+static void numa_build_fallback(void) {
+    for (uint32_t node = 0; node < numa_state.node_count; node++) {
+        uint8_t *order = numa_state.fallback[node];
+        for (uint32_t i = 0; i < numa_state.node_count; i++) order[i] = (uint8_t)i;
+
+        for (uint32_t i = 1; i < numa_state.node_count; i++) {
+            uint8_t key = order[i];
+            uint32_t j = i;
+            while (j > 0 && numa_state.distance[node][order[j - 1]] > numa_state.distance[node][key]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = key;
+        }
+
+        pmm_set_node_fallback(node, order, numa_state.node_count);
+    }
+}
+
+void numa_init(void) {
+    serial_puts("[NUMA] Initializing...\n");
+
+    numa_state.node_count = 0;
+    if (acpi_state.srat) {
+        numa_parse_srat(acpi_state.srat);
+    }
+
+    if (numa_state.node_count <= 1 || numa_state.range_count == 0) {
+        numa_state.node_count = 1;
+        numa_state.numa_available = false;
+        numa_state.distance[0][0] = NUMA_LOCAL_DISTANCE;
+        serial_puts("[NUMA] Single node system\n");
+        return;
+    }
+
+    for (uint32_t from = 0; from < numa_state.node_count; from++) {
+        for (uint32_t to = 0; to < numa_state.node_count; to++) {
+            numa_state.distance[from][to] = (from == to) ? NUMA_LOCAL_DISTANCE : NUMA_REMOTE_DISTANCE;
+        }
+    }
+    if (acpi_state.slit) {
+        numa_parse_slit(acpi_state.slit);
+    }
+
+    numa_build_fallback();
+
+    for (uint32_t i = 0; i < numa_state.range_count; i++) {
+        pmm_set_node_range(numa_state.ranges[i].base, numa_state.ranges[i].length,
+                           numa_state.ranges[i].node);
+    }
+    pmm_numa_rebalance();
+
+    smp_assign_numa_nodes();
+
+    numa_state.numa_available = true;
+    numa_dump_topology();
+}
+
+uint32_t numa_get_node_count(void) {
+    return numa_state.node_count ? numa_state.node_count : 1;
+}
+
+uint8_t numa_node_of_apic(uint32_t apic_id) {
+    for (uint32_t i = 0; i < numa_state.cpu_count; i++) {
+        if (numa_state.cpu_apic_id[i] == apic_id) return numa_state.cpu_node[i];
+    }
+    return 0;
+}
+
+uint8_t numa_node_of_address(uint64_t phys) {
+    for (uint32_t i = 0; i < numa_state.range_count; i++) {
+        struct numa_memory_range *range = &numa_state.ranges[i];
+        if (phys >= range->base && phys - range->base < range->length) return range->node;
+    }
+    return 0;
+}
+
+uint8_t numa_distance(uint8_t from, uint8_t to) {
+    if (from >= numa_get_node_count() || to >= numa_get_node_count()) return 0xFF;
+    if (!numa_state.numa_available) return NUMA_LOCAL_DISTANCE;
+    return numa_state.distance[from][to];
+}
+
+void numa_dump_topology(void) {
+    char buf[32];
+    serial_puts("[NUMA] ");
+    serial_puts(itoa(numa_state.node_count, buf, 10));
+    serial_puts(" nodes\n");
+
+    for (uint32_t node = 0; node < numa_state.node_count; node++) {
+        serial_puts("  Node ");
+        serial_puts(itoa(node, buf, 10));
+        serial_puts(" (domain ");
+        serial_puts(itoa(numa_state.proximity_domain[node], buf, 10));
+        serial_puts("): ");
+        serial_puts(itoa(pmm_get_node_free_memory(node) / 1024 / 1024, buf, 10));
+        serial_puts(" MB free, distances:");
+        for (uint32_t to = 0; to < numa_state.node_count; to++) {
+            serial_puts(" ");
+            serial_puts(itoa(numa_state.distance[node][to], buf, 10));
+        }
+        serial_puts("\n");
+    }
+}
@@ -1,9 +1,14 @@
 #include "include/sys/smp.h"
 #include "include/sys/apic.h"
 #include "include/sys/gdt.h"
+#include "include/sys/numa.h"
 #include "include/interrupts/idt.h"
 #include "include/memory/pmm.h"
 #include "include/memory/paging.h"
+#include "include/sys/spinlock.h"
+#include "include/tasking/task.h"
+#include "include/tasking/fpu.h"
+#include "include/sys/tick.h"
 #include "include/drivers/serial.h"
 #include "libc/string.h"
 #include "libc/stdio.h"
@@ -12,6 +17,11 @@ extern volatile struct limine_mp_request mp_request;
 struct smp_state smp_state = {0};
 static volatile struct limine_mp_response *mp_response = NULL;
 
+static void smp_write_gs_base(uint64_t base) {
+    asm volatile("wrmsr" : : "c"(MSR_GS_BASE), 
+                 "a"((uint32_t)base), "d"(base >> 32));
+}
+
 static void ap_entry(struct limine_mp_info *info) {
     uint32_t lapic_id = info->lapic_id;
     
@@ -45,16 +55,24 @@ static void ap_entry(struct limine_mp_info *info) {
         return;
     }
     
-    cpu->gs_base = (uint64_t)cpu;
-    asm volatile("wrmsr" : : "c"(0xC0000101), 
-                 "a"((uint32_t)cpu->gs_base), "d"(cpu->gs_base >> 32));
-    
+    // gdt_load перезагружает GS, поэтому GS base пишем после него
     gdt_load();
     idt_load();
+    paging_init_cpu();
+    // Задачи могут мигрировать сюда, а kernel.c и simd собраны с SSE
+    fpu_init_cpu();
+    
+    cpu->gs_base = (uint64_t)cpu;
+    smp_write_gs_base(cpu->gs_base);
     
     if (apic_state.apic_available) {
         lapic_write(LAPIC_SIV_REG, lapic_read(LAPIC_SIV_REG) | LAPIC_SIV_ENABLE);
         lapic_write(LAPIC_TASK_PRIO_REG, 0);
+        // Свой таймер на каждом CPU: кванты и балансировка считаются локально.
+        // Без IOAPIC вектор 32 занят PIT - AP будят только IPI
+        if (apic_state.ioapic_available) {
+            tick_init_cpu();
+        }
     }
     
     cpu->state = CPU_STATE_RUNNING;
@@ -65,10 +83,7 @@ static void ap_entry(struct limine_mp_info *info) {
     serial_put_hex64(lapic_id);
     serial_puts(" started successfully\n");
     
-    while (1) {
-        asm volatile("hlt");
-        asm volatile("pause");
-    }
+    task_start();
 }
 
 void smp_init(volatile struct limine_mp_response *limine_mp_response) {
@@ -87,6 +102,8 @@ void smp_init(volatile struct limine_mp_response *limine_mp_response) {
         smp_state.started_count = 1;
         smp_state.bsp_id = 0;
         
+        smp_write_gs_base(smp_state.cpus[0].gs_base);
+        smp_state.smp_initialized = true;
         return;
     }
     
@@ -114,6 +131,7 @@ void smp_init(volatile struct limine_mp_response *limine_mp_response) {
         if (smp_state.cpus[i].is_bsp) {
             smp_state.cpus[i].state = CPU_STATE_RUNNING;
             smp_state.cpus[i].gs_base = (uint64_t)&smp_state.cpus[i];
+            smp_write_gs_base(smp_state.cpus[i].gs_base);
             
             serial_puts("[SMP] BSP registered: LAPIC ID ");
             serial_put_hex64(smp_state.cpus[i].lapic_id);
@@ -125,6 +143,7 @@ void smp_init(volatile struct limine_mp_response *limine_mp_response) {
         }
     }
     
+    smp_state.smp_initialized = true;
     serial_puts("[SMP] SMP initialization complete\n");
 }
 
@@ -207,36 +226,39 @@ void smp_start_aps(void) {
     smp_state.started_count = 1 + running_aps; 
 }
 
+// Назначение пишется в старшее слово ICR первым: запись младшего слова отправляет IPI.
+// Прерывание между двумя записями могло бы отправить свой IPI и подменить назначение
+static void smp_write_icr(uint32_t lapic_id, uint32_t command) {
+    uint64_t irq = irq_save();
+    while (lapic_read(LAPIC_ICR1_REG) & (1 << 12)) {
+        asm volatile("pause");
+    }
+    lapic_write(LAPIC_ICR2_REG, lapic_id << 24);
+    lapic_write(LAPIC_ICR1_REG, command);
+    while (lapic_read(LAPIC_ICR1_REG) & (1 << 12)) {
+        asm volatile("pause");
+    }
+    irq_restore(irq);
+}
+
 void smp_send_init(uint32_t lapic_id) {
     if (!apic_state.apic_available) return;
-    
-    lapic_write(LAPIC_ICR1_REG, lapic_id << 24);
-    lapic_write(LAPIC_ICR2_REG, 0x00004500); 
-    while (lapic_read(LAPIC_ICR2_REG) & (1 << 12));
+    smp_write_icr(lapic_id, 0x00004500);
 }
 
 void smp_send_startup(uint32_t lapic_id, uint8_t vector) {
     if (!apic_state.apic_available) return;
-    
-    lapic_write(LAPIC_ICR1_REG, lapic_id << 24);
-    lapic_write(LAPIC_ICR2_REG, 0x00004600 | vector); 
-    while (lapic_read(LAPIC_ICR2_REG) & (1 << 12));
+    smp_write_icr(lapic_id, 0x00004600 | vector);
 }
 
 void smp_send_ipi(uint32_t lapic_id, uint8_t vector) {
     if (!apic_state.apic_available) return;
-    
-    lapic_write(LAPIC_ICR1_REG, lapic_id << 24);
-    lapic_write(LAPIC_ICR2_REG, 0x00004000 | vector); 
-    while (lapic_read(LAPIC_ICR2_REG) & (1 << 12));
+    smp_write_icr(lapic_id, 0x00004000 | vector);
 }
 
 void smp_broadcast_ipi(uint8_t vector) {
     if (!apic_state.apic_available) return;
-    
-    lapic_write(LAPIC_ICR1_REG, 0xFF << 24); 
-    lapic_write(LAPIC_ICR2_REG, 0x00004000 | vector); 
-    while (lapic_read(LAPIC_ICR2_REG) & (1 << 12));
+    smp_write_icr(0xFF, 0x00004000 | vector);
 }
 
 uint32_t smp_get_cpu_count(void) {
@@ -244,13 +266,7 @@ uint32_t smp_get_cpu_count(void) {
 }
 
 struct cpu_info *smp_get_current_cpu(void) {
-    if (smp_is_bsp()) {
-        return &smp_state.cpus[0];
-    }
-    
-    uint64_t gs_base;
-    asm volatile("rdmsr" : "=a"(gs_base) : "c"(0xC0000101) : "edx");
-    return (struct cpu_info*)gs_base;
+    return &smp_state.cpus[smp_current_cpu_id()];
 }
 
 struct cpu_info *smp_get_cpu_info(uint32_t cpu_id) {
@@ -258,6 +274,19 @@ struct cpu_info *smp_get_cpu_info(uint32_t cpu_id) {
     return &smp_state.cpus[cpu_id];
 }
 
+void smp_assign_numa_nodes(void) {
+    for (uint32_t i = 0; i < smp_state.cpu_count && i < MAX_CPUS; i++) {
+        smp_state.cpus[i].numa_node = numa_node_of_apic(smp_state.cpus[i].lapic_id);
+
+        serial_puts("[SMP] CPU ");
+        char buf[16];
+        serial_puts(itoa(i, buf, 10));
+        serial_puts(" -> NUMA node ");
+        serial_puts(itoa(smp_state.cpus[i].numa_node, buf, 10));
+        serial_puts("\n");
+    }
+}
+
 bool smp_is_bsp(void) {
     if (smp_state.cpu_count == 0) return true;
     
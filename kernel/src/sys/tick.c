@@ -0,0 +1,299 @@
+#include "include/sys/tick.h"
+#include "include/sys/apic.h"
+#include "include/sys/smp.h"
+#include "include/sys/spinlock.h"
+#include "include/tasking/task.h"
+#include "include/simd/simd.h"
+#include "include/drivers/serial.h"
+#include "libc/string.h"
+
+// Сроки CPU в нс по tick_now_ns; 0 - срока нет
+struct tick_cpu {
+    uint64_t next_event;        // на что заведён LAPIC
+    uint64_t tick_deadline;     // следующий тик планировщика
+    uint64_t sleep_deadline;    // ближайшее пробуждение tick_sleep_ns
+    struct tick_stats stats;
+} __attribute__((aligned(64)));
+
+static struct tick_cpu tick_cpus[MAX_CPUS];
+static bool tick_nohz = false;
+
+// Пересчёт через множители с 32-битной дробной частью: деления в 128 бит
+// потребовали бы libgcc
+static bool clock_tsc = false;
+static uint64_t clock_base = 0;
+static uint64_t clock_mult = 0;     // нс на такт часов << 32
+static uint64_t lapic_mult = 0;     // тактов LAPIC на нс << 32
+static uint64_t lapic_hz = 0;
+static uint64_t tsc_hz = 0;
+
+static inline uint64_t read_tsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t mul_shift32(uint64_t a, uint64_t mult) {
+    return (uint64_t)(((unsigned __int128)a * mult) >> 32);
+}
+
+static inline uint64_t clock_read(void) {
+    return clock_tsc ? read_tsc() : hpet_read(HPET_MAIN_COUNTER);
+}
+
+uint64_t tick_now_ns(void) {
+    if (!clock_mult) return 0;
+    return mul_shift32(clock_read() - clock_base, clock_mult);
+}
+
+bool tick_nohz_active(void) {
+    return tick_nohz;
+}
+
+static bool tsc_invariant(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 0x80000007) return false;
+    cpuid(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+    return edx & (1U << 8);
+}
+
+// LAPIC и TSC считают TICK_CALIBRATE_MS по HPET
+static bool tick_calibrate(void) {
+    if (!apic_state.hpet_available || !apic_state.hpet_frequency) return false;
+
+    uint64_t period_fs = apic_state.hpet_frequency;
+    uint64_t wait = TICK_CALIBRATE_MS * 1000000000000ULL / period_fs;
+
+    lapic_write(LAPIC_TIMER_DIVIDER, TICK_LAPIC_DIVIDER);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_MASKED | TICK_VECTOR);
+
+    uint64_t irq = irq_save();
+    uint64_t h0 = hpet_read(HPET_MAIN_COUNTER);
+    uint64_t t0 = read_tsc();
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    while (hpet_read(HPET_MAIN_COUNTER) - h0 < wait) {
+        asm volatile("pause");
+    }
+    uint32_t current = lapic_read(LAPIC_TIMER_CURRENT);
+    uint64_t t1 = read_tsc();
+    uint64_t h1 = hpet_read(HPET_MAIN_COUNTER);
+    irq_restore(irq);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    uint64_t elapsed_ns = (h1 - h0) * period_fs / 1000000;
+    if (!elapsed_ns) return false;
+
+    lapic_hz = (uint64_t)(0xFFFFFFFFU - current) * 1000000000ULL / elapsed_ns;
+    tsc_hz = (t1 - t0) * 1000000000ULL / elapsed_ns;
+    if (!lapic_hz) return false;
+    lapic_mult = (lapic_hz << 32) / 1000000000ULL;
+
+    // TSC дешевле HPET в разы, но годится только с постоянной частотой
+    clock_tsc = tsc_invariant() && tsc_hz;
+    if (clock_tsc) {
+        clock_mult = (1000000000ULL << 32) / tsc_hz;
+        clock_base = t1;
+    } else {
+        clock_mult = (period_fs << 32) / 1000000;
+        clock_base = h1;
+    }
+    return true;
+}
+
+static void tick_program(struct tick_cpu *cpu, uint64_t next, uint64_t now) {
+    if (next == cpu->next_event) return;
+    cpu->next_event = next;
+
+    if (!next) {
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+        return;
+    }
+    // +1: округление вниз разбудило бы раньше срока
+    uint64_t count = mul_shift32(next > now ? next - now : 0, lapic_mult) + 1;
+    if (count > 0xFFFFFFFFULL) count = 0xFFFFFFFFULL;   // проснёмся раньше и заведём снова
+    lapic_write(LAPIC_TIMER_INITIAL, (uint32_t)count);
+}
+
+static void tick_reprogram(struct tick_cpu *cpu, uint64_t now) {
+    if (task_tick_needed()) {
+        if (!cpu->tick_deadline) cpu->tick_deadline = now + TICK_PERIOD_NS;
+    } else if (cpu->tick_deadline) {
+        cpu->tick_deadline = 0;
+        cpu->stats.stops++;
+    }
+
+    uint64_t next = cpu->tick_deadline;
+    if (cpu->sleep_deadline && (!next || cpu->sleep_deadline < next)) next = cpu->sleep_deadline;
+    tick_program(cpu, next, now);
+}
+
+void tick_update(void) {
+    if (!tick_nohz) return;
+    uint64_t flags = irq_save();
+    tick_reprogram(&tick_cpus[smp_current_cpu_id()], tick_now_ns());
+    irq_restore(flags);
+}
+
+bool tick_sched_stopped(uint32_t cpu) {
+    return tick_nohz && cpu < MAX_CPUS && !tick_cpus[cpu].tick_deadline;
+}
+
+void tick_interrupt(void) {
+    struct tick_cpu *cpu = &tick_cpus[smp_current_cpu_id()];
+    uint64_t now = tick_now_ns();
+    uint64_t expected = cpu->next_event;
+
+    cpu->stats.interrupts++;
+    cpu->next_event = 0;    // one-shot отработал
+    if (expected && now >= expected) {
+        uint64_t late = now - expected;
+        cpu->stats.late_samples++;
+        cpu->stats.late_total_ns += late;
+        if (late > cpu->stats.late_max_ns) cpu->stats.late_max_ns = late;
+    } else if (expected) {
+        cpu->stats.early++;
+    }
+
+    if (cpu->sleep_deadline && now >= cpu->sleep_deadline) cpu->sleep_deadline = 0;
+
+    if (cpu->tick_deadline && now >= cpu->tick_deadline) {
+        cpu->stats.sched_ticks++;
+        task_scheduler_tick();
+        // Сетка тиков от первого срока, а не от момента обработки: опоздания не копятся
+        cpu->tick_deadline += TICK_PERIOD_NS;
+        if (cpu->tick_deadline <= now) {
+            uint64_t missed = (now - cpu->tick_deadline) / TICK_PERIOD_NS + 1;
+            cpu->stats.missed_ticks += missed;
+            cpu->tick_deadline += missed * TICK_PERIOD_NS;
+        }
+    }
+
+    tick_reprogram(cpu, now);
+}
+
+void tick_sleep_ns(uint64_t ns) {
+    uint64_t deadline = tick_now_ns() + ns;
+
+    while (tick_now_ns() < deadline) {
+        uint64_t flags = irq_save();
+        // Задачу могли перенести на другой CPU - срок заводим там, где она сейчас
+        struct tick_cpu *cpu = &tick_cpus[smp_current_cpu_id()];
+        if (!cpu->sleep_deadline || deadline < cpu->sleep_deadline) cpu->sleep_deadline = deadline;
+        tick_reprogram(cpu, tick_now_ns());
+
+        if (flags & RFLAGS_IF) {
+            // sti откладывает прерывание до hlt: срабатывание не теряется
+            asm volatile("sti; hlt" ::: "memory");
+        } else {
+            asm volatile("pause");
+        }
+    }
+}
+
+void tick_init_cpu(void) {
+    if (!apic_state.apic_available) return;
+    if (!tick_nohz) {
+        lapic_timer_init(TICK_VECTOR, TICK_HZ);
+        return;
+    }
+
+    uint64_t flags = irq_save();
+    struct tick_cpu *cpu = &tick_cpus[smp_current_cpu_id()];
+    cpu->next_event = 0;
+    cpu->tick_deadline = 0;
+    cpu->sleep_deadline = 0;
+
+    lapic_write(LAPIC_TIMER_DIVIDER, TICK_LAPIC_DIVIDER);
+    lapic_write(LAPIC_LVT_TIMER, TICK_VECTOR);      // one-shot
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    irq_restore(flags);
+}
+
+void tick_init(void) {
+    char buf[32];
+
+    if (!tick_calibrate()) {
+        serial_puts("[TICK] No HPET to calibrate LAPIC, using periodic tick\n");
+        tick_init_cpu();
+        return;
+    }
+    tick_nohz = true;
+
+    serial_puts("[TICK] LAPIC timer ");
+    serial_puts(itoa(lapic_hz, buf, 10));
+    serial_puts(" Hz, TSC ");
+    serial_puts(itoa(tsc_hz, buf, 10));
+    serial_puts(" Hz, clock source ");
+    serial_puts(clock_tsc ? "TSC" : "HPET");
+    serial_puts("\n[TICK] NO_HZ: one-shot LAPIC, tick stops on idle and single-task CPUs\n");
+
+    tick_init_cpu();
+}
+
+bool tick_get_stats(uint32_t cpu, struct tick_stats *stats) {
+    if (cpu >= MAX_CPUS || !stats) return false;
+    *stats = tick_cpus[cpu].stats;
+    return true;
+}
+
+void tick_dump_stats(void) {
+    uint64_t now = tick_now_ns();
+
+    serial_puts("[TICK] Timer statistics:\n");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct tick_stats *st = &tick_cpus[cpu].stats;
+        if (!st->interrupts && !st->stops) continue;
+
+        char buf[32];
+        serial_puts("  CPU");
+        serial_puts(itoa(cpu, buf, 10));
+        serial_puts(": interrupts=");
+        serial_puts(itoa(st->interrupts, buf, 10));
+        serial_puts(" (");
+        serial_puts(itoa(now >= 1000000000ULL ? st->interrupts / (now / 1000000000ULL) : st->interrupts, buf, 10));
+        serial_puts("/s) sched_ticks=");
+        serial_puts(itoa(st->sched_ticks, buf, 10));
+        serial_puts(" missed=");
+        serial_puts(itoa(st->missed_ticks, buf, 10));
+        serial_puts(" stops=");
+        serial_puts(itoa(st->stops, buf, 10));
+        serial_puts(" early=");
+        serial_puts(itoa(st->early, buf, 10));
+        serial_puts(" late avg=");
+        serial_puts(itoa(st->late_samples ? st->late_total_ns / st->late_samples : 0, buf, 10));
+        serial_puts("ns max=");
+        serial_puts(itoa(st->late_max_ns, buf, 10));
+        serial_puts("ns\n");
+    }
+}
+
+// Задержка пробуждения по одиночному сроку: от срока до возврата из hlt
+void tick_jitter_bench(uint32_t samples, uint64_t period_us) {
+    if (!tick_nohz || !samples) return;
+
+    uint64_t total = 0;
+    uint64_t best = UINT64_MAX;
+    uint64_t worst = 0;
+    for (uint32_t i = 0; i < samples; i++) {
+        uint64_t deadline = tick_now_ns() + period_us * 1000;
+        tick_sleep_ns(period_us * 1000);
+        uint64_t late = tick_now_ns() - deadline;
+        total += late;
+        if (late < best) best = late;
+        if (late > worst) worst = late;
+    }
+
+    char buf[32];
+    serial_puts("[TICK] One-shot wakeup latency: ");
+    serial_puts(itoa(total / samples, buf, 10));
+    serial_puts(" ns avg, ");
+    serial_puts(itoa(best, buf, 10));
+    serial_puts(" ns best, ");
+    serial_puts(itoa(worst, buf, 10));
+    serial_puts(" ns worst (");
+    serial_puts(itoa(samples, buf, 10));
+    serial_puts(" x ");
+    serial_puts(itoa(period_us, buf, 10));
+    serial_puts(" us)\n");
+}
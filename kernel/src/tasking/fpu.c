@@ -0,0 +1,263 @@
+#include "include/tasking/fpu.h"
+#include "include/tasking/task.h"
+#include "include/simd/simd.h"
+#include "include/memory/slab.h"
+#include "include/sys/smp.h"
+#include "include/interrupts/idt.h"
+#include "include/interrupts/isr.h"
+#include "include/drivers/serial.h"
+#include "libc/string.h"
+
+#define CR0_TS          (1ULL << 3)
+#define CR4_OSXSAVE     (1ULL << 18)
+#define MSR_IA32_XSS    0xDA0
+
+#define FXSAVE_SIZE     512
+#define XSAVE_HDR_SIZE  64
+#define XCOMP_BV_COMPACT (1ULL << 63)
+
+// Начало области XSAVE: legacy-часть FXSAVE и заголовок
+struct fpu_legacy {
+    uint16_t fcw;
+    uint16_t fsw;
+    uint8_t ftw;
+    uint8_t reserved0;
+    uint16_t fop;
+    uint64_t fip;
+    uint64_t fdp;
+    uint32_t mxcsr;
+    uint32_t mxcsr_mask;
+    uint8_t regs[FXSAVE_SIZE - 32];
+    uint64_t xstate_bv;
+    uint64_t xcomp_bv;
+    uint8_t reserved1[XSAVE_HDR_SIZE - 16];
+} __attribute__((packed));
+
+// Чьи регистры сейчас в этом CPU; active - CR0.TS снят
+struct fpu_cpu {
+    struct task *owner;
+    bool active;
+    struct fpu_stats stats;
+} __attribute__((aligned(64)));
+
+static struct fpu_cpu fpu_cpus[MAX_CPUS];
+static enum fpu_mode fpu_mode = FPU_MODE_FXSAVE;
+static uint64_t fpu_xcr0 = 0;
+static uint32_t fpu_size = FXSAVE_SIZE;
+static struct kmem_cache *fpu_cache = NULL;
+static void *fpu_init_state = NULL;
+
+static inline void fpu_clts(void) {
+    asm volatile("clts" ::: "memory");
+}
+
+static inline void fpu_stts(void) {
+    uint64_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" :: "r"(cr0 | CR0_TS) : "memory");
+}
+
+static void fpu_save(void *state) {
+    uint32_t lo = (uint32_t)fpu_xcr0;
+    uint32_t hi = (uint32_t)(fpu_xcr0 >> 32);
+
+    switch (fpu_mode) {
+    case FPU_MODE_XSAVES:
+        asm volatile("xsaves64 (%0)" :: "r"(state), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_MODE_XSAVEOPT:
+        asm volatile("xsaveopt64 (%0)" :: "r"(state), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_MODE_XSAVE:
+        asm volatile("xsave64 (%0)" :: "r"(state), "a"(lo), "d"(hi) : "memory");
+        break;
+    default:
+        asm volatile("fxsave64 (%0)" :: "r"(state) : "memory");
+        break;
+    }
+}
+
+static void fpu_restore(void *state) {
+    uint32_t lo = (uint32_t)fpu_xcr0;
+    uint32_t hi = (uint32_t)(fpu_xcr0 >> 32);
+
+    switch (fpu_mode) {
+    case FPU_MODE_XSAVES:
+        asm volatile("xrstors64 (%0)" :: "r"(state), "a"(lo), "d"(hi) : "memory");
+        break;
+    case FPU_MODE_XSAVEOPT:
+    case FPU_MODE_XSAVE:
+        asm volatile("xrstor64 (%0)" :: "r"(state), "a"(lo), "d"(hi) : "memory");
+        break;
+    default:
+        asm volatile("fxrstor64 (%0)" :: "r"(state) : "memory");
+        break;
+    }
+}
+
+// #NM: задача впервые в этом кванте тронула x87/SSE/AVX
+static void fpu_trap(struct registers *regs) {
+    (void)regs;
+    uint32_t id = smp_current_cpu_id();
+    struct fpu_cpu *cpu = &fpu_cpus[id];
+    struct task *t = task_current();
+
+    fpu_clts();
+    cpu->active = true;
+    if (!t) return;     // контекст загрузки до task_start
+
+    fpu_restore(t->fpu_state ? t->fpu_state : fpu_init_state);
+    cpu->owner = t;
+    t->fpu_cpu = id;
+    cpu->stats.traps++;
+}
+
+void fpu_switch(struct task *prev, struct task *next) {
+    uint32_t id = smp_current_cpu_id();
+    struct fpu_cpu *cpu = &fpu_cpus[id];
+
+    if (cpu->owner == prev) {
+        if (prev->state == TASK_STATE_EXITED) {
+            cpu->owner = NULL;
+        } else if (cpu->active && prev->fpu_state) {
+            fpu_save(prev->fpu_state);
+            cpu->stats.saves++;
+        }
+    }
+
+    // Регистры next ещё в этом CPU, если их никто не сменил и задача не
+    // загружала их на другом CPU
+    if (cpu->owner == next && next->fpu_cpu == id) {
+        if (!cpu->active) fpu_clts();
+        cpu->active = true;
+        cpu->stats.reuses++;
+    } else if (cpu->active) {
+        fpu_stts();
+        cpu->active = false;
+    }
+}
+
+void fpu_init_cpu(void) {
+    enable_sse();
+
+    if (fpu_mode != FPU_MODE_FXSAVE) {
+        uint64_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" :: "r"(cr4 | CR4_OSXSAVE) : "memory");
+        asm volatile("xsetbv" :: "c"(0), "a"((uint32_t)fpu_xcr0), "d"((uint32_t)(fpu_xcr0 >> 32)));
+    }
+    if (fpu_mode == FPU_MODE_XSAVES) {
+        // Супервизорных компонентов не сохраняем
+        asm volatile("wrmsr" :: "c"(MSR_IA32_XSS), "a"(0), "d"(0));
+    }
+
+    struct fpu_cpu *cpu = &fpu_cpus[smp_current_cpu_id()];
+    cpu->owner = NULL;
+    cpu->active = true;     // enable_sse снял CR0.TS
+}
+
+static void fpu_detect(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    if (!(ecx & (1U << 26)) || cpuid_get_max_leaf() < 0xD) return;
+
+    cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+    fpu_xcr0 = (((uint64_t)edx << 32) | eax) & FPU_XSTATE_KNOWN;
+    if ((fpu_xcr0 & FPU_XSTATE_AVX512) != FPU_XSTATE_AVX512) fpu_xcr0 &= ~FPU_XSTATE_AVX512;
+
+    cpuid(0xD, 1, &eax, &ebx, &ecx, &edx);
+    if (eax & (1U << 3)) {
+        fpu_mode = FPU_MODE_XSAVES;
+    } else if (eax & (1U << 0)) {
+        fpu_mode = FPU_MODE_XSAVEOPT;
+    } else {
+        fpu_mode = FPU_MODE_XSAVE;
+    }
+}
+
+// Размер известен только после записи XCR0 (и IA32_XSS для XSAVES)
+static uint32_t fpu_detect_size(void) {
+    uint32_t eax, ebx, ecx, edx;
+    if (fpu_mode == FPU_MODE_FXSAVE) return FXSAVE_SIZE;
+    cpuid(0xD, fpu_mode == FPU_MODE_XSAVES ? 1 : 0, &eax, &ebx, &ecx, &edx);
+    return ebx;
+}
+
+void fpu_init(void) {
+    fpu_detect();
+    fpu_init_cpu();
+    fpu_size = fpu_detect_size();
+
+    fpu_cache = kmem_cache_create("fpu_state", fpu_size, FPU_STATE_ALIGN, NULL);
+    if (!fpu_cache) {
+        serial_puts("[FPU] ERROR: Failed to create state cache\n");
+        return;
+    }
+
+    // Начальное состояние как после FNINIT; остальные компоненты в init
+    struct fpu_legacy *init = kmem_cache_alloc(fpu_cache);
+    if (!init) {
+        serial_puts("[FPU] ERROR: No memory for initial state\n");
+        return;
+    }
+    memset(init, 0, fpu_size);
+    init->fcw = 0x37F;
+    init->mxcsr = 0x1F80;
+    if (fpu_mode != FPU_MODE_FXSAVE) {
+        init->xstate_bv = FPU_XSTATE_X87 | FPU_XSTATE_SSE;
+        if (fpu_mode == FPU_MODE_XSAVES) init->xcomp_bv = XCOMP_BV_COMPACT | fpu_xcr0;
+    }
+    fpu_init_state = init;
+
+    isr_install_handler(EXCEPTION_DEVICE_NOT_AVAILABLE, fpu_trap);
+
+    static const char *mode_names[] = { "FXSAVE", "XSAVE", "XSAVEOPT", "XSAVES" };
+    char buf[32];
+    serial_puts("[FPU] Lazy state switching: ");
+    serial_puts(mode_names[fpu_mode]);
+    serial_puts(", XCR0 0x");
+    serial_puts(itoa(fpu_xcr0, buf, 16));
+    serial_puts(", ");
+    serial_puts(itoa(fpu_size, buf, 10));
+    serial_puts(" bytes per task\n");
+}
+
+void *fpu_state_alloc(void) {
+    if (!fpu_cache || !fpu_init_state) return NULL;
+    void *state = kmem_cache_alloc(fpu_cache);
+    if (state) memcpy(state, fpu_init_state, fpu_size);
+    return state;
+}
+
+void fpu_state_free(void *state) {
+    if (state) kmem_cache_free(fpu_cache, state);
+}
+
+uint32_t fpu_state_size(void) {
+    return fpu_size;
+}
+
+bool fpu_get_stats(uint32_t cpu, struct fpu_stats *stats) {
+    if (cpu >= MAX_CPUS || !stats) return false;
+    *stats = fpu_cpus[cpu].stats;
+    return true;
+}
+
+void fpu_dump_stats(void) {
+    serial_puts("[FPU] Lazy switch statistics:\n");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct fpu_stats *st = &fpu_cpus[cpu].stats;
+        if (!st->traps && !st->saves && !st->reuses) continue;
+
+        char buf[32];
+        serial_puts("  CPU");
+        serial_puts(itoa(cpu, buf, 10));
+        serial_puts(": traps=");
+        serial_puts(itoa(st->traps, buf, 10));
+        serial_puts(" saves=");
+        serial_puts(itoa(st->saves, buf, 10));
+        serial_puts(" reuses=");
+        serial_puts(itoa(st->reuses, buf, 10));
+        serial_puts("\n");
+    }
+}
@@ -1,69 +1,597 @@
 #include "include/tasking/task.h"
+#include "include/tasking/fpu.h"
 #include "include/memory/heap.h"
+#include "include/memory/vmalloc.h"
+#include "include/memory/slab.h"
+#include "include/memory/pmm.h"
+#include "include/sys/spinlock.h"
+#include "include/sys/smp.h"
+#include "include/sys/apic.h"
+#include "include/sys/tick.h"
+#include "include/interrupts/idt.h"
 #include "include/drivers/serial.h"
 #include "libc/string.h"
 
-static struct task *task_list = NULL;
-struct task *current_task = NULL;
+extern void context_switch(uint64_t *prev_rsp, uint64_t next_rsp);
+extern void task_trampoline(void);
+
+// Очередь FIFO на каждый приоритет; бит в ready_mask - очередь не пуста
+struct task_queue {
+    struct task *head;
+    struct task *tail;
+};
+
+// Очереди своего CPU. lock держится через context_switch и снимается уже
+// следующей задачей (task_finish_switch): пока сохраняется rsp предыдущей,
+// её нельзя забрать в другую очередь
+struct cpu_rq {
+    spinlock_t lock;
+    uint32_t id;
+    volatile bool online;
+    volatile bool need_resched;
+    uint32_t ready_mask;
+    volatile uint32_t queued;
+    struct task_queue queues[TASK_PRIO_COUNT];
+    struct task *volatile current;
+    struct task *zombies;
+    struct task idle;
+    uint64_t ticks;
+    struct task_cpu_stats stats;
+} __attribute__((aligned(64)));
+
+static struct cpu_rq cpu_rqs[MAX_CPUS];
+static struct kmem_cache *task_cache = NULL;
 static uint32_t next_task_id = 1;
 
+static inline struct cpu_rq *this_rq(void) {
+    return &cpu_rqs[smp_current_cpu_id()];
+}
+
+static inline uint32_t rq_limit(void) {
+    return smp_state.cpu_count < MAX_CPUS ? smp_state.cpu_count : MAX_CPUS;
+}
+
+// Задач на CPU: ожидающие и выполняемая
+static inline uint32_t rq_load(struct cpu_rq *rq) {
+    return rq->queued + (rq->current && rq->current != &rq->idle);
+}
+
+// Кадр, который context_switch снимет при первом входе в задачу
+static void task_build_frame(struct task *t, void *stack_top, uint64_t entry_ip, uint64_t r12, uint64_t r13) {
+    uint64_t *sp = (uint64_t*)((uint64_t)stack_top & ~0xFULL);
+    *--sp = 0;              // выравнивание: на входе rsp % 16 == 8, как после call
+    *--sp = entry_ip;
+    *--sp = 0;              // rbx
+    *--sp = 0;              // rbp
+    *--sp = r12;
+    *--sp = r13;
+    *--sp = 0;              // r14
+    *--sp = 0;              // r15
+    t->rsp = (uint64_t)sp;
+}
+
+static void enqueue(struct cpu_rq *rq, struct task *t) {
+    struct task_queue *queue = &rq->queues[t->priority];
+    t->next = NULL;
+    t->cpu = rq->id;
+    if (queue->tail) {
+        queue->tail->next = t;
+    } else {
+        queue->head = t;
+    }
+    queue->tail = t;
+    rq->ready_mask |= 1U << t->priority;
+    rq->queued++;
+}
+
+static struct task *dequeue(struct cpu_rq *rq) {
+    if (!rq->ready_mask) return NULL;
+
+    uint32_t priority = __builtin_ctz(rq->ready_mask);
+    struct task_queue *queue = &rq->queues[priority];
+    struct task *t = queue->head;
+    queue->head = t->next;
+    if (!queue->head) {
+        queue->tail = NULL;
+        rq->ready_mask &= ~(1U << priority);
+    }
+    rq->queued--;
+    t->next = NULL;
+    return t;
+}
+
+static inline bool higher_ready(struct cpu_rq *rq, uint8_t priority) {
+    return rq->ready_mask && (uint32_t)__builtin_ctz(rq->ready_mask) < priority;
+}
+
+// Блокировки двух очередей берутся по возрастанию номера CPU
+static void lock_pair(struct cpu_rq *a, struct cpu_rq *b) {
+    if (a < b) {
+        spin_lock(&a->lock);
+        spin_lock(&b->lock);
+    } else {
+        spin_lock(&b->lock);
+        spin_lock(&a->lock);
+    }
+}
+
+static void unlock_pair(struct cpu_rq *a, struct cpu_rq *b) {
+    spin_unlock(&a->lock);
+    spin_unlock(&b->lock);
+}
+
+// В очередь rq добавлена задача. Без NO_HZ чужой CPU заметит её на своём тике,
+// с остановленным тиком - только по IPI
+static void resched_cpu(struct cpu_rq *rq, bool preempt) {
+    struct cpu_rq *local = this_rq();
+    if (rq == local) {
+        if (preempt) rq->need_resched = true;
+        tick_update();
+        return;
+    }
+    if (!preempt && !tick_sched_stopped(rq->id)) return;
+    local->stats.resched_ipis++;
+    smp_send_ipi(smp_state.cpus[rq->id].lapic_id, TASK_RESCHED_VECTOR);
+}
+
+// Здесь ждут задачи, а простаивающие CPU спят без тика и сами не придут за работой
+static void kick_idle_cpu(struct cpu_rq *self) {
+    for (uint32_t i = 0; i < rq_limit(); i++) {
+        struct cpu_rq *rq = &cpu_rqs[i];
+        if (rq == self || !rq->online || rq->queued || rq->current != &rq->idle) continue;
+        self->stats.resched_ipis++;
+        smp_send_ipi(smp_state.cpus[rq->id].lapic_id, TASK_RESCHED_VECTOR);
+        return;
+    }
+}
+
+// Менее всего загруженный CPU; при равенстве остаёмся на своём
+static struct cpu_rq *select_rq(void) {
+    struct cpu_rq *local = this_rq();
+    struct cpu_rq *best = local;
+    uint32_t best_load = rq_load(local);
+
+    for (uint32_t i = 0; i < rq_limit() && best_load; i++) {
+        struct cpu_rq *rq = &cpu_rqs[i];
+        if (rq == local || !rq->online) continue;
+        uint32_t load = rq_load(rq);
+        if (load < best_load) {
+            best = rq;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+// Самая длинная чужая очередь, в которой ждут не меньше min_queued задач
+static struct cpu_rq *find_busiest(struct cpu_rq *self, uint32_t min_queued) {
+    struct cpu_rq *busiest = NULL;
+    uint32_t max_queued = min_queued ? min_queued - 1 : 0;
+
+    for (uint32_t i = 0; i < rq_limit(); i++) {
+        struct cpu_rq *rq = &cpu_rqs[i];
+        if (rq == self || !rq->online) continue;
+        uint32_t queued = rq->queued;
+        if (queued > max_queued) {
+            busiest = rq;
+            max_queued = queued;
+        }
+    }
+    return busiest;
+}
+
+// Обе блокировки взяты. Переносится ожидающая задача с наивысшим приоритетом:
+// на своём CPU она всё равно стоит за выполняемой
+static struct task *migrate_one(struct cpu_rq *src, struct cpu_rq *dst) {
+    struct task *t = dequeue(src);
+    if (t) enqueue(dst, t);
+    return t;
+}
+
+// Простаивающий CPU забирает одну задачу. Прерывания выключены
+static bool task_steal(struct cpu_rq *rq) {
+    struct cpu_rq *busiest = find_busiest(rq, 1);
+    if (!busiest) return false;
+
+    lock_pair(rq, busiest);
+    struct task *t = migrate_one(busiest, rq);
+    unlock_pair(rq, busiest);
+
+    if (!t) return false;
+    rq->stats.steals++;
+    return true;
+}
+
+// Периодическое выравнивание: забираем половину разницы с самой загруженной очередью
+static void task_balance(struct cpu_rq *rq) {
+    struct cpu_rq *busiest = find_busiest(rq, 2);
+    if (!busiest) return;
+
+    lock_pair(rq, busiest);
+    uint32_t src_load = rq_load(busiest);
+    uint32_t dst_load = rq_load(rq);
+    uint32_t moves = src_load > dst_load + 1 ? (src_load - dst_load) / 2 : 0;
+    if (moves > TASK_BALANCE_BATCH) moves = TASK_BALANCE_BATCH;
+
+    uint32_t pulled = 0;
+    while (pulled < moves && migrate_one(busiest, rq)) pulled++;
+
+    struct task *curr = rq->current;
+    if (pulled && curr && (curr == &rq->idle || higher_ready(rq, curr->priority))) {
+        rq->need_resched = true;
+    }
+    unlock_pair(rq, busiest);
+
+    rq->stats.pulls += pulled;
+}
+
 void task_init(struct task *t, uint64_t entry, void *stack_top, uint32_t id) {
     memset(t, 0, sizeof(struct task));
-    t->rip = entry;
-    t->rsp = (uint64_t)stack_top;
-    t->rflags = 0x202; // IF=1 (разрешены прерывания)
-    t->cs = 0x08;
-    t->ss = 0x10;
+    task_build_frame(t, stack_top, (uint64_t)task_trampoline, entry, 0);
     t->id = id;
     t->state = TASK_STATE_READY;
     t->stack_top = stack_top;
-    t->next = NULL;
+    t->priority = TASK_PRIO_DEFAULT;
+    t->timeslice = TASK_DEFAULT_SLICE;
+    t->slice_left = TASK_DEFAULT_SLICE;
+    t->fpu_state = fpu_state_alloc();
+    t->fpu_cpu = FPU_CPU_NONE;
 }
 
-void task_add(struct task *t) {
-    if (!task_list) {
-        task_list = t;
-    } else {
-        struct task *last = task_list;
-        while (last->next) last = last->next;
-        last->next = t;
+struct task *task_create(void (*entry)(void *arg), void *arg, uint8_t priority) {
+    if (!task_cache || priority >= TASK_PRIO_COUNT) return NULL;
+
+    struct task *t = (struct task*)kmem_cache_alloc(task_cache);
+    if (!t) return NULL;
+
+    // Стек из vmalloc: переполнение упрётся в guard-страницу
+    void *stack = vmalloc(TASK_STACK_SIZE);
+    if (!stack) {
+        kmem_cache_free(task_cache, t);
+        return NULL;
+    }
+
+    uint32_t id = __sync_fetch_and_add(&next_task_id, 1);
+
+    task_init(t, (uint64_t)entry, (uint8_t*)stack + TASK_STACK_SIZE, id);
+    if (!t->fpu_state) {
+        vfree(stack);
+        kmem_cache_free(task_cache, t);
+        return NULL;
     }
+    task_build_frame(t, t->stack_top, (uint64_t)task_trampoline, (uint64_t)entry, (uint64_t)arg);
+    t->stack_base = stack;
+    t->flags = TASK_FLAG_ALLOCATED;
+    t->priority = priority;
+    return t;
 }
 
-static struct task *task_get_next_ready(void) {
-    if (!current_task) return task_list;
+void task_add(struct task *t) {
+    if (!t || t->priority >= TASK_PRIO_COUNT) return;
 
-    struct task *t = current_task->next;
-    while (t) {
-        if (t->state == TASK_STATE_READY) return t;
-        t = t->next;
+    uint64_t flags = irq_save();
+    struct cpu_rq *rq = select_rq();
+    spin_lock(&rq->lock);
+    t->state = TASK_STATE_READY;
+    enqueue(rq, t);
+    struct task *curr = rq->current;
+    bool preempt = curr && (curr == &rq->idle || t->priority < curr->priority);
+    spin_unlock(&rq->lock);
+
+    resched_cpu(rq, preempt);
+    irq_restore(flags);
+}
+
+// Очередь, в которой сейчас задача, с взятой блокировкой. t->cpu меняется
+// только под блокировкой старой очереди, поэтому после захвата проверяем снова
+static struct cpu_rq *lock_task_rq(struct task *t) {
+    for (;;) {
+        struct cpu_rq *rq = &cpu_rqs[t->cpu];
+        spin_lock(&rq->lock);
+        if (rq == &cpu_rqs[t->cpu]) return rq;
+        spin_unlock(&rq->lock);
     }
+}
+
+void task_set_priority(struct task *t, uint8_t priority) {
+    if (!t || priority >= TASK_PRIO_COUNT) return;
 
-    t = task_list;
-    while (t && t != current_task) {
-        if (t->state == TASK_STATE_READY) return t;
-        t = t->next;
+    uint64_t flags = irq_save();
+    struct cpu_rq *rq = lock_task_rq(t);
+    if (t->state == TASK_STATE_READY && t != rq->current) {
+        // Переносим из старой очереди в новую
+        struct task_queue *queue = &rq->queues[t->priority];
+        struct task *prev = NULL;
+        for (struct task *it = queue->head; it; prev = it, it = it->next) {
+            if (it != t) continue;
+            if (prev) prev->next = t->next; else queue->head = t->next;
+            if (queue->tail == t) queue->tail = prev;
+            if (!queue->head) rq->ready_mask &= ~(1U << t->priority);
+            rq->queued--;
+            break;
+        }
+        t->priority = priority;
+        enqueue(rq, t);
+    } else {
+        t->priority = priority;
     }
-    return NULL;
+    struct task *curr = rq->current;
+    bool preempt = curr && higher_ready(rq, curr->priority);
+    spin_unlock(&rq->lock);
+
+    if (preempt) resched_cpu(rq, true);
+    irq_restore(flags);
+}
+
+void task_set_timeslice(struct task *t, uint32_t ticks) {
+    if (!t || !ticks) return;
+    t->timeslice = ticks;
+    if (t->slice_left > ticks) t->slice_left = ticks;
+}
+
+static void task_resched_handler(struct registers *regs) {
+    (void)regs;
+    lapic_eoi();
+    struct cpu_rq *rq = this_rq();
+    struct task *curr = rq->current;
+    if (curr && (curr == &rq->idle || higher_ready(rq, curr->priority))) rq->need_resched = true;
+    tick_update();
+    task_preempt();
 }
 
 void tasking_init(void) {
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        cpu_rqs[i].id = i;
+    }
+    task_cache = kmem_cache_create("task", sizeof(struct task), 0, NULL);
+    fpu_init();
+    isr_install_handler(TASK_RESCHED_VECTOR, task_resched_handler);
     serial_puts("[TASK] Tasking subsystem initialized\n");
 }
 
-void task_scheduler_tick(void) {
-    if (!current_task) return;
+// Тик нужен, только пока есть кому отдать квант
+bool task_tick_needed(void) {
+    struct cpu_rq *rq = this_rq();
+    return rq->current && rq->queued;
+}
+
+struct task *task_current(void) {
+    uint64_t flags = irq_save();
+    struct task *t = this_rq()->current;
+    irq_restore(flags);
+    return t;
+}
 
-    struct task *next = task_get_next_ready();
-    if (!next || next == current_task) return;
+void task_finish_switch(void) {
+    spin_unlock(&this_rq()->lock);
+}
 
-    extern void save_current_context(struct task* t);
-    extern void switch_to_task(struct task *t);
+// Вызывается с выключенными прерываниями. Текущая задача встаёт в хвост
+// своей очереди, поэтому равные по приоритету идут по кругу.
+// После context_switch задача может продолжиться уже на другом CPU
+static void schedule(struct cpu_rq *rq) {
+    spin_lock(&rq->lock);
+    struct task *prev = rq->current;
 
-    save_current_context(current_task);
-    current_task->state = TASK_STATE_READY;
+    if (prev != &rq->idle) {
+        if (prev->state == TASK_STATE_RUNNING) {
+            prev->state = TASK_STATE_READY;
+            enqueue(rq, prev);
+        } else if (prev->state == TASK_STATE_EXITED) {
+            prev->next = rq->zombies;
+            rq->zombies = prev;
+        }
+    }
+
+    struct task *next = dequeue(rq);
+    if (!next) next = &rq->idle;
     next->state = TASK_STATE_RUNNING;
-    switch_to_task(next);
+    next->slice_left = next->timeslice;
+    next->cpu = rq->id;
+    if (next == prev) {
+        spin_unlock(&rq->lock);
+        return;
+    }
+
+    next->switches++;
+    rq->stats.switches++;
+    rq->current = next;
+    fpu_switch(prev, next);
+    tick_update();      // из idle в задачу, за которой очередь: тик снова нужен
+    context_switch(&prev->rsp, next->rsp);
+    task_finish_switch();
+}
+
+// Стек завершённой задачи нельзя освободить, пока она на нём работает
+static void task_reap(struct cpu_rq *rq) {
+    if (!rq->zombies) return;
+
+    uint64_t flags = spin_lock_irqsave(&rq->lock);
+    struct task *list = rq->zombies;
+    rq->zombies = NULL;
+    spin_unlock_irqrestore(&rq->lock, flags);
+
+    while (list) {
+        struct task *t = list;
+        list = t->next;
+        fpu_state_free(t->fpu_state);
+        t->fpu_state = NULL;
+        if (t->flags & TASK_FLAG_ALLOCATED) {
+            vfree(t->stack_base);
+            kmem_cache_free(task_cache, t);
+        }
+    }
+}
+
+void task_start(void) {
+    asm volatile("cli");
+    struct cpu_rq *rq = this_rq();
+    struct task *idle = &rq->idle;
+    memset(idle, 0, sizeof(*idle));
+    idle->state = TASK_STATE_RUNNING;
+    idle->priority = TASK_PRIO_COUNT;
+    idle->timeslice = TASK_DEFAULT_SLICE;
+    idle->cpu = rq->id;
+    idle->fpu_state = fpu_state_alloc();
+    idle->fpu_cpu = FPU_CPU_NONE;
+    rq->current = idle;
+    rq->online = true;
+
+    serial_puts("[TASK] CPU ");
+    char buf[16];
+    serial_puts(itoa(rq->id, buf, 10));
+    serial_puts(" entering scheduler\n");
+
+    for (;;) {
+        task_reap(rq);
+        pmm_zero_pool_refill(PMM_ZERO_POOL_BATCH);
+
+        asm volatile("cli");
+        if (!rq->ready_mask) task_steal(rq);
+        if (rq->ready_mask) {
+            rq->need_resched = false;
+            schedule(rq);
+            asm volatile("sti");
+        } else {
+            tick_update();
+            // sti откладывает прерывание до hlt: пробуждение не теряется
+            asm volatile("sti; hlt");
+        }
+    }
+}
 
-    current_task = next;
-}
\ No newline at end of file
+void task_yield(void) {
+    uint64_t flags = irq_save();
+    struct cpu_rq *rq = this_rq();
+    rq->need_resched = false;
+    schedule(rq);
+    irq_restore(flags);
+}
+
+void task_exit(void) {
+    irq_save();
+    struct cpu_rq *rq = this_rq();
+    rq->current->state = TASK_STATE_EXITED;
+    schedule(rq);
+    for (;;) asm volatile("hlt");
+}
+
+// Из прерывания таймера своего CPU. С NO_HZ приходит, только пока в очереди
+// кто-то ждёт: load_avg и busy/idle_ticks считаются лишь по этим тикам
+void task_scheduler_tick(void) {
+    struct cpu_rq *rq = this_rq();
+    struct task *t = rq->current;
+    if (!t) return;
+
+    uint32_t load = rq_load(rq);
+    rq->stats.load_avg += ((int32_t)(load << 10) - (int32_t)rq->stats.load_avg) / 32;
+    if (++rq->ticks % TASK_BALANCE_INTERVAL == 0) {
+        task_balance(rq);
+        if (rq->queued && tick_nohz_active()) kick_idle_cpu(rq);
+    }
+
+    if (t == &rq->idle) {
+        rq->stats.idle_ticks++;
+        if (rq->ready_mask) rq->need_resched = true;
+        return;
+    }
+    rq->stats.busy_ticks++;
+    if (t->slice_left) t->slice_left--;
+    if (!t->slice_left || higher_ready(rq, t->priority)) rq->need_resched = true;
+}
+
+void task_preempt(void) {
+    struct cpu_rq *rq = this_rq();
+    if (!rq->need_resched || !rq->current) return;
+    rq->need_resched = false;
+    schedule(rq);
+}
+
+bool task_get_cpu_stats(uint32_t cpu, struct task_cpu_stats *stats) {
+    if (cpu >= MAX_CPUS || !stats) return false;
+    struct cpu_rq *rq = &cpu_rqs[cpu];
+    *stats = rq->stats;
+    stats->nr_running = rq_load(rq);
+    return true;
+}
+
+void task_dump_stats(void) {
+    serial_puts("[TASK] Scheduler statistics:\n");
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        struct task_cpu_stats st;
+        if (!cpu_rqs[cpu].online || !task_get_cpu_stats(cpu, &st)) continue;
+
+        uint64_t ticks = st.busy_ticks + st.idle_ticks;
+        char buf[32];
+        serial_puts("  CPU");
+        serial_puts(itoa(cpu, buf, 10));
+        serial_puts(": running=");
+        serial_puts(itoa(st.nr_running, buf, 10));
+        serial_puts(" load=");
+        serial_puts(itoa(st.load_avg * 100 / 1024, buf, 10));
+        serial_puts("% busy=");
+        serial_puts(itoa(ticks ? st.busy_ticks * 100 / ticks : 0, buf, 10));
+        serial_puts("% switches=");
+        serial_puts(itoa(st.switches, buf, 10));
+        serial_puts(" steals=");
+        serial_puts(itoa(st.steals, buf, 10));
+        serial_puts(" pulls=");
+        serial_puts(itoa(st.pulls, buf, 10));
+        serial_puts(" ipis=");
+        serial_puts(itoa(st.resched_ipis, buf, 10));
+        serial_puts("\n");
+    }
+}
+
+static inline uint64_t read_tsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint64_t bench_ping_rsp;
+static uint64_t bench_pong_rsp;
+
+static void bench_pong(void) {
+    for (;;) context_switch(&bench_pong_rsp, bench_ping_rsp);
+}
+
+// Две стороны передают управление друг другу напрямую, без планировщика:
+// меряется сам путь context_switch
+void task_switch_bench(uint32_t rounds) {
+    if (!rounds) return;
+
+    void *stack = vmalloc(TASK_BENCH_STACK_SIZE);
+    if (!stack) {
+        serial_puts("[TASK] ERROR: No stack for switch benchmark\n");
+        return;
+    }
+
+    struct task pong;
+    task_build_frame(&pong, (uint8_t*)stack + TASK_BENCH_STACK_SIZE, (uint64_t)bench_pong, 0, 0);
+    bench_pong_rsp = pong.rsp;
+
+    uint64_t flags = irq_save();
+    context_switch(&bench_ping_rsp, bench_pong_rsp);   // прогрев
+
+    uint64_t best = UINT64_MAX;
+    uint64_t start = read_tsc();
+    for (uint32_t i = 0; i < rounds; i++) {
+        uint64_t t0 = read_tsc();
+        context_switch(&bench_ping_rsp, bench_pong_rsp);
+        uint64_t round = read_tsc() - t0;
+        if (round < best) best = round;
+    }
+    uint64_t total = read_tsc() - start;
+    irq_restore(flags);
+    vfree(stack);
+
+    char buf[32];
+    serial_puts("[TASK] Context switch: ");
+    serial_puts(itoa(total / rounds / 2, buf, 10));
+    serial_puts(" cycles avg, ");
+    serial_puts(itoa(best / 2, buf, 10));
+    serial_puts(" cycles best (");
+    serial_puts(itoa(rounds, buf, 10));
+    serial_puts(" round trips)\n");
+}